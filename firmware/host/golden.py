@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+#
+# Renders a fixed scene on the host build and compares the panel with a golden frame.
+#
+#   golden.py <picogame_host> <golden.ppm> [--update]
+#
+# The scene is a cartridge whose VM code clears the screen, sets pixels, blits both pong assets (one partly off the
+# screen), prints the buttons it reads, shows a sprite and syncs once, then halts. The run holds the left button
+# down (GPIO 28), so the input path is part of the frame too. A frame that differs is written to the current
+# directory, named after the golden one with the .actual extension. --update writes the golden frame itself.
+
+import argparse
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "tools"))
+
+import cart
+
+PONG_DIR      = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "source", "carts", "pong")
+RUN_TIME      = 1000          # milliseconds
+BUTTON_LEVELS = 1 << 28       # left
+
+# same values as VM_OP_* and VM_SYS_* in api.h
+OP_HALT   = 0
+OP_PUSH8  = 2
+OP_PUSH16 = 3
+OP_SYS    = 36
+
+SYS_SYNC           = 0
+SYS_CLEAR          = 1
+SYS_SET_BACKGROUND = 2
+SYS_SET_FOREGROUND = 3
+SYS_SET_PIXEL      = 6
+SYS_BLIT_ASSET     = 7
+SYS_PRINT          = 8
+SYS_SET_SPRITE     = 9
+SYS_READ_BUTTONS   = 12
+
+# assets are indexed in name order: code, pong_ball, pong_bar
+BALL_ASSET = 1
+BAR_ASSET  = 2
+
+TEXT = b"BUTTONS %d\0"
+
+
+def push(value):
+    if -128 <= value < 128:
+        return struct.pack("<Bb", OP_PUSH8, value)
+
+    return struct.pack("<Bh", OP_PUSH16, value)
+
+
+def call(syscall, *arguments):
+    return b"".join(push(argument) for argument in arguments) + bytes([OP_SYS, syscall])
+
+
+# the text address is always a PUSH16, so the size of the code does not depend on it
+def print_buttons(x, y, address):
+    return push(x) + push(y) + struct.pack("<Bh", OP_PUSH16, address) + call(SYS_READ_BUTTONS) + bytes([OP_SYS, SYS_PRINT])
+
+
+def assemble():
+    code = call(SYS_SET_BACKGROUND, 0xFF - 256) + call(SYS_CLEAR)
+
+    for step in range(40):
+        code += call(SYS_SET_PIXEL, 20 + step, 20 + (step // 2), 0xE0 - 256)
+
+    code += call(SYS_BLIT_ASSET, BALL_ASSET, 30, 40)
+    code += call(SYS_BLIT_ASSET, BAR_ASSET, -10, 110)
+    code += call(SYS_SET_FOREGROUND, 0)
+    code += call(SYS_SET_SPRITE, 0, 120, 70, BALL_ASSET, 0, 0, 0)
+
+    # the text follows the code
+    tail    = call(SYS_SYNC) + bytes([OP_HALT])
+    address = len(code) + len(print_buttons(5, 5, 0)) + len(tail)
+
+    code += print_buttons(5, 5, address) + tail
+
+    # vm_load() wants the last byte to stop the machine
+    return code + TEXT + bytes([OP_HALT])
+
+
+def render(host, directory):
+    code_path  = os.path.join(directory, "code")
+    cart_path  = os.path.join(directory, "golden.cart")
+    frame_path = os.path.join(directory, "frame.ppm")
+
+    with open(code_path, "wb") as file:
+        file.write(assemble())
+
+    with open(cart_path, "wb") as file:
+        file.write(cart.pack("golden", [code_path, os.path.join(PONG_DIR, "pong_ball.png"), os.path.join(PONG_DIR, "pong_bar.png")]))
+
+    subprocess.run([host, "-t", str(RUN_TIME), "-c", cart_path, "-i", str(BUTTON_LEVELS), "-o", frame_path], check=True, stdout=subprocess.DEVNULL)
+
+    with open(frame_path, "rb") as file:
+        return file.read()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compares the host rendering of a fixed scene with a golden frame.")
+    parser.add_argument("host")
+    parser.add_argument("golden")
+    parser.add_argument("--update", action="store_true")
+    arguments = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as directory:
+        frame = render(arguments.host, directory)
+
+    if arguments.update:
+        with open(arguments.golden, "wb") as file:
+            file.write(frame)
+
+        return
+
+    with open(arguments.golden, "rb") as file:
+        golden = file.read()
+
+    if frame != golden:
+        actual = os.path.basename(arguments.golden) + ".actual"
+
+        with open(actual, "wb") as file:
+            file.write(frame)
+
+        different = sum(1 for index in range(min(len(frame), len(golden))) if frame[index] != golden[index])
+        sys.exit("%s: %d bytes differ, the frame is in %s" % (arguments.golden, different, actual))
+
+
+if __name__ == "__main__":
+    main()
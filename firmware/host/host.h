@@ -0,0 +1,23 @@
+#ifndef HOST_H
+#define HOST_H
+
+#include "pico/stdlib.h"
+
+// must match the display wiring in display.c
+#define HOST_PANEL_DC_PIN 1
+#define HOST_PANEL_TE_PIN 3
+
+#define HOST_PANEL_WIDTH        320
+#define HOST_PANEL_HEIGHT       240
+#define HOST_PANEL_REFRESH_RATE 70
+
+#define HOST_FLASH_SIZE (2 * 1024 * 1024)
+
+void     panel_write(const bool is_data, const uint8_t value);
+bool     panel_dump(const char* path);
+uint64_t panel_get_pixel_bytes(void);
+uint64_t panel_get_command_count(void);
+
+void host_set_inputs(const uint32_t levels);
+
+#endif
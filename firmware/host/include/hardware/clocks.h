@@ -0,0 +1,15 @@
+#ifndef HARDWARE_CLOCKS_H
+#define HARDWARE_CLOCKS_H
+
+#include "pico/stdlib.h"
+
+enum clock_index {
+    clk_sys = 5,
+};
+
+// the default system clock of the SDK
+static inline uint32_t clock_get_hz(enum clock_index clock) {
+    return 125000000;
+}
+
+#endif
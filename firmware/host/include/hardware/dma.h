@@ -0,0 +1,50 @@
+#ifndef HARDWARE_DMA_H
+#define HARDWARE_DMA_H
+
+#include "hardware/irq.h"
+#include "pico/stdlib.h"
+
+enum dma_channel_transfer_size {
+    DMA_SIZE_8  = 0,
+    DMA_SIZE_16 = 1,
+    DMA_SIZE_32 = 2,
+};
+
+typedef struct {
+        uint32_t ctrl;
+        bool     is_byte_swapped;
+        bool     is_irq_quiet;
+} dma_channel_config;
+
+typedef struct {
+        volatile uint32_t al3_transfer_count;
+        volatile uint32_t al3_read_addr_trig;
+} dma_channel_hw_t;
+
+typedef struct {
+        dma_channel_hw_t ch[12];
+} dma_hw_t;
+
+extern dma_hw_t host_dma;
+
+#define dma_hw (&host_dma)
+
+int                dma_claim_unused_channel(bool required);
+dma_channel_config dma_channel_get_default_config(uint channel);
+void               channel_config_set_transfer_data_size(dma_channel_config* config, enum dma_channel_transfer_size size);
+void               channel_config_set_bswap(dma_channel_config* config, bool is_byte_swapped);
+void               channel_config_set_dreq(dma_channel_config* config, uint dreq);
+void               channel_config_set_read_increment(dma_channel_config* config, bool is_incremented);
+void               channel_config_set_write_increment(dma_channel_config* config, bool is_incremented);
+void               channel_config_set_ring(dma_channel_config* config, bool is_write, uint size_bits);
+void               channel_config_set_chain_to(dma_channel_config* config, uint channel);
+void               channel_config_set_irq_quiet(dma_channel_config* config, bool is_quiet);
+void               dma_channel_configure(uint channel, const dma_channel_config* config, volatile void* write_address, const volatile void* read_address,
+                                         uint transfer_count, bool trigger);
+void               dma_channel_transfer_from_buffer_now(uint channel, const volatile void* read_address, uint32_t transfer_count);
+void               dma_channel_set_read_addr(uint channel, const volatile void* read_address, bool trigger);
+bool               dma_channel_get_irq0_status(uint channel);
+void               dma_channel_set_irq0_enabled(uint channel, bool enabled);
+void               dma_channel_acknowledge_irq0(uint channel);
+
+#endif
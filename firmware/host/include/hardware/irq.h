@@ -0,0 +1,13 @@
+#ifndef HARDWARE_IRQ_H
+#define HARDWARE_IRQ_H
+
+#include "pico/stdlib.h"
+
+#define DMA_IRQ_0 11
+
+typedef void (*irq_handler_t)(void);
+
+void irq_set_exclusive_handler(uint irq, irq_handler_t handler);
+void irq_set_enabled(uint irq, bool enabled);
+
+#endif
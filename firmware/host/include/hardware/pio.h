@@ -0,0 +1,27 @@
+#ifndef HARDWARE_PIO_H
+#define HARDWARE_PIO_H
+
+#include "pico/stdlib.h"
+
+typedef struct {
+        volatile uint32_t txf[4];
+} pio_hw_t;
+
+typedef pio_hw_t* PIO;
+
+typedef struct {
+        const uint16_t* instructions;
+        uint8_t         length;
+        int8_t          origin;
+} pio_program_t;
+
+extern pio_hw_t host_pio0;
+
+#define pio0 (&host_pio0)
+
+int  pio_claim_unused_sm(PIO pio, bool required);
+uint pio_add_program(PIO pio, const pio_program_t* program);
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data);
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx);
+
+#endif
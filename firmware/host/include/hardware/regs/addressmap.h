@@ -0,0 +1,11 @@
+#ifndef HARDWARE_REGS_ADDRESSMAP_H
+#define HARDWARE_REGS_ADDRESSMAP_H
+
+#include <stdint.h>
+
+// the flash is an array, a cartridge file can be loaded into it (see host/main.c)
+extern uint8_t host_flash[];
+
+#define XIP_BASE ((uintptr_t) host_flash)
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef HARDWARE_SPI_H
+#define HARDWARE_SPI_H
+
+#include "pico/stdlib.h"
+
+typedef struct {
+        volatile uint32_t dr;
+} spi_hw_t;
+
+typedef struct {
+        spi_hw_t hw;
+} spi_inst_t;
+
+extern spi_inst_t host_spi;
+
+#define spi_default (&host_spi)
+
+uint      spi_init(spi_inst_t* spi, uint baudrate);
+int       spi_write_blocking(spi_inst_t* spi, const uint8_t* source, size_t length);
+int       spi_read_blocking(spi_inst_t* spi, uint8_t repeated_data, uint8_t* target, size_t length);
+bool      spi_is_busy(const spi_inst_t* spi);
+spi_hw_t* spi_get_hw(spi_inst_t* spi);
+uint      spi_get_dreq(spi_inst_t* spi, bool is_tx);
+
+#endif
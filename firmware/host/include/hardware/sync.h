@@ -0,0 +1,23 @@
+#ifndef HARDWARE_SYNC_H
+#define HARDWARE_SYNC_H
+
+#include "pico/stdlib.h"
+
+typedef struct spin_lock spin_lock_t;
+
+uint32_t     save_and_disable_interrupts(void);
+void         restore_interrupts(uint32_t status);
+int          spin_lock_claim_unused(bool required);
+spin_lock_t* spin_lock_init(uint lock_number);
+uint32_t     spin_lock_blocking(spin_lock_t* lock);
+void         spin_unlock(spin_lock_t* lock, uint32_t saved_interrupts);
+
+static inline void __dmb(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+// the event register of each core, __wfe() gives up after a millisecond in case a wakeup is not simulated
+void __sev(void);
+void __wfe(void);
+
+#endif
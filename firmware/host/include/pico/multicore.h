@@ -0,0 +1,9 @@
+#ifndef PICO_MULTICORE_H
+#define PICO_MULTICORE_H
+
+#include "pico/stdlib.h"
+
+// core1 is a thread
+void multicore_launch_core1(void (*entry)(void));
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef PICO_STDLIB_H
+#define PICO_STDLIB_H
+
+// Host stand-in for the parts of the Pico SDK the firmware uses, see host/sdk.c.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef unsigned int uint;
+
+#ifndef MIN
+    #define MIN(a, b) ((b) > (a) ? (a) : (b))
+#endif
+
+#ifndef MAX
+    #define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+#define count_of(a) (sizeof(a) / sizeof((a)[0]))
+
+#define __in_flash(...)
+#define __not_in_flash_func(name) name
+
+#define GPIO_IN  false
+#define GPIO_OUT true
+
+enum gpio_irq_level {
+    GPIO_IRQ_LEVEL_LOW  = 0x1,
+    GPIO_IRQ_LEVEL_HIGH = 0x2,
+    GPIO_IRQ_EDGE_FALL  = 0x4,
+    GPIO_IRQ_EDGE_RISE  = 0x8,
+};
+
+typedef uint64_t absolute_time_t;
+
+typedef void (*gpio_irq_callback_t)(uint gpio, uint32_t events);
+
+enum gpio_function {
+    GPIO_FUNC_SPI = 1,
+    GPIO_FUNC_SIO = 5,
+};
+
+uint64_t time_us_64(void);
+uint32_t time_us_32(void);
+void     sleep_us(uint64_t us);
+void     sleep_ms(uint32_t ms);
+void     sleep_until(absolute_time_t target);
+bool     best_effort_wfe_or_timeout(absolute_time_t timeout);
+
+static inline absolute_time_t from_us_since_boot(uint64_t us) {
+    return us;
+}
+
+uint get_core_num(void);
+
+void     gpio_init(uint gpio);
+void     gpio_set_dir(uint gpio, bool out);
+void     gpio_set_function(uint gpio, enum gpio_function function);
+void     gpio_pull_down(uint gpio);
+void     gpio_put(uint gpio, bool value);
+bool     gpio_get(uint gpio);
+uint32_t gpio_get_all(void);
+void     gpio_set_irq_enabled(uint gpio, uint32_t events, bool enabled);
+void     gpio_set_irq_enabled_with_callback(uint gpio, uint32_t events, bool enabled, gpio_irq_callback_t callback);
+
+bool stdio_init_all(void);
+
+static inline void tight_loop_contents(void) {
+}
+
+#endif
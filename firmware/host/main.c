@@ -0,0 +1,126 @@
+#include "api.h"
+#include "host.h"
+#include "pico/stdlib.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Runs the firmware headless for a while, then writes what the panel shows to a PPM file.
+//
+//   picogame_host [-t milliseconds] [-o frame.ppm] [-c game.cart] [-i gpio levels] [-r record.ipr]
+//
+// The recording (of a PICOGAME_INPUT_RECORD build) replays from a cartridge that carries it as its replay asset.
+
+extern uint8_t host_flash[];
+
+// the firmware main(), renamed by the build
+int firmware_main(void);
+
+static void* run_core0(void* argument) {
+    firmware_main();
+    return NULL;
+}
+
+static bool load_cart(const char* path) {
+    FILE* file = fopen(path, "rb");
+    bool  is_loaded;
+
+    if (file == NULL) {
+        return false;
+    }
+
+    is_loaded = fread(&host_flash[CART_FLASH_OFFSET], 1, MIN(CART_FLASH_SIZE, HOST_FLASH_SIZE - CART_FLASH_OFFSET), file) > 0;
+    fclose(file);
+
+    return is_loaded;
+}
+
+static bool save_record(const char* path) {
+    const uint8_t* record;
+    uint32_t       size;
+    FILE*          file;
+    bool           is_saved;
+
+    if ((record = ipu_get_record(&size)) == NULL) {
+        return false;
+    }
+
+    if ((file = fopen(path, "wb")) == NULL) {
+        return false;
+    }
+
+    is_saved = fwrite(record, 1, size, file) == size;
+    fclose(file);
+
+    return is_saved;
+}
+
+int main(int argc, char** argv) {
+    const char*     output   = "frame.ppm";
+    const char*     record   = NULL;
+    uint32_t        duration = 2000;
+    pthread_t       core0;
+    int             option;
+    display_stats   stats;
+    gpu_frame_stats frames;
+
+    while ((option = getopt(argc, argv, "t:o:c:i:r:")) != -1) {
+        switch (option) {
+            case 't':
+                duration = strtoul(optarg, NULL, 0);
+                break;
+
+            case 'o':
+                output = optarg;
+                break;
+
+            case 'c':
+                if (!load_cart(optarg)) {
+                    fprintf(stderr, "cannot load %s\n", optarg);
+                    return 1;
+                }
+
+                break;
+
+            case 'i':
+                host_set_inputs(strtoul(optarg, NULL, 0));
+                break;
+
+            case 'r':
+                record = optarg;
+                break;
+
+            default:
+                fprintf(stderr, "usage: %s [-t milliseconds] [-o frame.ppm] [-c game.cart] [-i gpio levels] [-r record.ipr]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    pthread_create(&core0, NULL, run_core0, NULL);
+    sleep_ms(duration);
+
+    if (!panel_dump(output)) {
+        fprintf(stderr, "cannot write %s\n", output);
+        return 1;
+    }
+
+    if ((record != NULL) && !save_record(record)) {
+        fprintf(stderr, "cannot write %s (is PICOGAME_INPUT_RECORD on?)\n", record);
+        return 1;
+    }
+
+    printf("%llu commands, %llu pixel bytes\n", (unsigned long long) panel_get_command_count(), (unsigned long long) panel_get_pixel_bytes());
+
+    display_get_frame_stats(&stats);
+    printf("last frame: %u commands, %u windows, %u pixel bytes, %u us busy\n", stats.commands, stats.windows, stats.pixel_bytes, stats.busy_time);
+
+    gpu_get_frame_stats(&frames);
+    printf("frames: %u presented, %u dropped, %u skipped, %u late, %u throttled, %u us latency\n", frames.presented, frames.dropped, frames.skipped, frames.late,
+           frames.throttled, frames.last_latency);
+    printf("raster: %u cells, %u by core0\n", frames.rasterized_cells, frames.assisted_cells);
+
+    // the firmware never returns, its threads end with the process
+    exit(0);
+}
@@ -0,0 +1,141 @@
+#include "host.h"
+
+#include <stdio.h>
+
+// A virtual ILI9341: it keeps the column and page windows and stores the 16-bit pixels of WRITE_MEMORY and
+// WRITE_MEMORY_CONTINUE, every other command is ignored. The panel is always landscape, which is how display_init()
+// sets it up.
+
+#define SET_COLUMN_ADDRESS    0x2A
+#define SET_PAGE_ADDRESS      0x2B
+#define WRITE_MEMORY          0x2C
+#define WRITE_MEMORY_CONTINUE 0x3C
+
+static struct {
+        uint16_t pixels[HOST_PANEL_HEIGHT][HOST_PANEL_WIDTH];
+
+        uint8_t command;
+        uint8_t parameters[4];
+        uint8_t parameter_count;
+
+        struct {
+                uint16_t start_column;
+                uint16_t end_column;
+                uint16_t start_page;
+                uint16_t end_page;
+                uint16_t column;
+                uint16_t page;
+        } window;
+
+        uint8_t high_byte;
+        bool    has_high_byte;
+
+        uint64_t pixel_bytes;
+        uint64_t command_count;
+} panel;
+
+static void write_pixel(const uint8_t value) {
+    panel.pixel_bytes++;
+
+    if (!panel.has_high_byte) {
+        panel.high_byte     = value;
+        panel.has_high_byte = true;
+        return;
+    }
+
+    panel.has_high_byte = false;
+
+    if (panel.window.page > panel.window.end_page) {
+        return;
+    }
+
+    if ((panel.window.column < HOST_PANEL_WIDTH) && (panel.window.page < HOST_PANEL_HEIGHT)) {
+        panel.pixels[panel.window.page][panel.window.column] = (panel.high_byte << 8) | value;
+    }
+
+    if (++panel.window.column > panel.window.end_column) {
+        panel.window.column = panel.window.start_column;
+        panel.window.page++;
+    }
+}
+
+void panel_write(const bool is_data, const uint8_t value) {
+    uint16_t start, end;
+
+    if (!is_data) {
+        panel.command         = value;
+        panel.parameter_count = 0;
+        panel.has_high_byte   = false;
+        panel.command_count++;
+
+        if (value == WRITE_MEMORY) {
+            panel.window.column = panel.window.start_column;
+            panel.window.page   = panel.window.start_page;
+        }
+
+        return;
+    }
+
+    switch (panel.command) {
+        case SET_COLUMN_ADDRESS:
+        case SET_PAGE_ADDRESS:
+            if (panel.parameter_count >= 4) {
+                break;
+            }
+
+            panel.parameters[panel.parameter_count++] = value;
+
+            if (panel.parameter_count == 4) {
+                start = (panel.parameters[0] << 8) | panel.parameters[1];
+                end   = (panel.parameters[2] << 8) | panel.parameters[3];
+
+                if (panel.command == SET_COLUMN_ADDRESS) {
+                    panel.window.start_column = start;
+                    panel.window.end_column   = end;
+                } else {
+                    panel.window.start_page = start;
+                    panel.window.end_page   = end;
+                }
+            }
+
+            break;
+
+        case WRITE_MEMORY:
+        case WRITE_MEMORY_CONTINUE:
+            write_pixel(value);
+            break;
+    }
+}
+
+// binary PPM, any image tool reads it
+bool panel_dump(const char* path) {
+    FILE*    file = fopen(path, "wb");
+    uint16_t color;
+    uint8_t  rgb[3];
+
+    if (file == NULL) {
+        return false;
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", HOST_PANEL_WIDTH, HOST_PANEL_HEIGHT);
+
+    for (uint16_t y = 0; y < HOST_PANEL_HEIGHT; y++) {
+        for (uint16_t x = 0; x < HOST_PANEL_WIDTH; x++) {
+            color  = panel.pixels[y][x];
+            rgb[0] = ((color >> 11) & 0b11111) * 255 / 31;
+            rgb[1] = ((color >> 5) & 0b111111) * 255 / 63;
+            rgb[2] = (color & 0b11111) * 255 / 31;
+            fwrite(rgb, 1, sizeof(rgb), file);
+        }
+    }
+
+    return fclose(file) == 0;
+}
+
+uint64_t panel_get_pixel_bytes(void) {
+    return panel.pixel_bytes;
+}
+
+uint64_t panel_get_command_count(void) {
+    return panel.command_count;
+}
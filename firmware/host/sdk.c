@@ -0,0 +1,556 @@
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
+#include "hardware/regs/addressmap.h"
+#include "hardware/spi.h"
+#include "hardware/sync.h"
+#include "host.h"
+#include "pico/multicore.h"
+#include "pico/stdlib.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+// The SDK functions the firmware calls, on top of pthreads. Each core is a thread with its own interrupt handlers,
+// and DMA transfers complete as soon as they start, raising their interrupt on the calling thread (or when it
+// enables interrupts again).
+
+#define IRQ_COUNT         32
+#define DMA_CHANNEL_COUNT 12
+#define SPIN_LOCK_COUNT   32
+#define PIO_SM_COUNT      4
+#define GPIO_COUNT        30
+#define WFE_TIMEOUT       1000    // microseconds
+
+uint8_t host_flash[HOST_FLASH_SIZE];
+
+// the linker symbol cart.c checks, the firmware itself takes no flash here
+extern char __flash_binary_end __attribute__((alias("host_flash")));
+
+spi_inst_t host_spi;
+pio_hw_t   host_pio0;
+dma_hw_t   host_dma;
+
+static _Thread_local uint core_number;
+
+static struct {
+        irq_handler_t handlers[IRQ_COUNT];
+        bool          is_enabled[IRQ_COUNT];
+        bool          is_pending[IRQ_COUNT];
+        uint32_t      disable_depth;
+        bool          is_in_handler;
+} cores[2];
+
+static struct {
+        volatile uint32_t   outputs;
+        volatile uint32_t   inputs;
+        gpio_irq_callback_t callbacks[2];    // one per core, as in the SDK
+        uint32_t            irq_events[GPIO_COUNT];
+        uint8_t             irq_cores[GPIO_COUNT];
+        bool                is_tearing;
+} gpio;
+
+static struct {
+        pthread_mutex_t mutex;
+        pthread_cond_t  signal;
+        bool            is_set[2];
+} events = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+struct spin_lock {
+        pthread_mutex_t mutex;
+        bool            is_claimed;
+};
+
+static spin_lock_t spin_locks[SPIN_LOCK_COUNT];
+
+// what the display program (source/display.pio) has taken in of the current transaction
+static struct {
+        bool     is_claimed;
+        uint8_t  header_entries;
+        uint8_t  command;
+        uint32_t data_bits;
+} pio_sms[PIO_SM_COUNT];
+
+static struct {
+        bool               is_claimed;
+        bool               is_irq0_enabled;
+        bool               is_irq0_pending;
+        uint32_t           transfer_count;
+        dma_channel_config config;
+        volatile void*     write_address;
+} dma_channels[DMA_CHANNEL_COUNT];
+
+// Time
+
+uint64_t time_us_64(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t) now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+uint32_t time_us_32(void) {
+    return (uint32_t) time_us_64();
+}
+
+void sleep_us(uint64_t us) {
+    struct timespec duration = {us / 1000000, (us % 1000000) * 1000};
+
+    nanosleep(&duration, NULL);
+}
+
+void sleep_ms(uint32_t ms) {
+    sleep_us((uint64_t) ms * 1000);
+}
+
+void sleep_until(absolute_time_t target) {
+    uint64_t now = time_us_64();
+
+    if (target > now) {
+        sleep_us(target - now);
+    }
+}
+
+// Events
+
+// waits until the event of the calling core is set (and clears it), or until the timeout
+static void wait_for_event(const uint64_t timeout) {
+    struct timespec deadline;
+    uint64_t        nanoseconds;
+
+    // the condition waits on the realtime clock, time_us_64() is the monotonic one
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    nanoseconds      = deadline.tv_nsec + ((timeout - MIN(timeout, time_us_64())) * 1000);
+    deadline.tv_sec += nanoseconds / 1000000000;
+    deadline.tv_nsec = nanoseconds % 1000000000;
+
+    pthread_mutex_lock(&events.mutex);
+
+    while (!events.is_set[core_number] && (time_us_64() < timeout)) {
+        pthread_cond_timedwait(&events.signal, &events.mutex, &deadline);
+    }
+
+    events.is_set[core_number] = false;
+    pthread_mutex_unlock(&events.mutex);
+}
+
+void __sev(void) {
+    pthread_mutex_lock(&events.mutex);
+    events.is_set[0] = true;
+    events.is_set[1] = true;
+    pthread_cond_broadcast(&events.signal);
+    pthread_mutex_unlock(&events.mutex);
+}
+
+void __wfe(void) {
+    wait_for_event(time_us_64() + WFE_TIMEOUT);
+}
+
+bool best_effort_wfe_or_timeout(absolute_time_t timeout) {
+    if (timeout <= time_us_64()) {
+        return true;
+    }
+
+    wait_for_event(timeout);
+    return time_us_64() >= timeout;
+}
+
+bool stdio_init_all(void) {
+    return true;
+}
+
+// Interrupts
+
+static void run_pending_handlers(void) {
+    typeof(cores[0])* core = &cores[core_number];
+    bool              has_run;
+
+    if ((core->disable_depth > 0) || core->is_in_handler) {
+        return;
+    }
+
+    core->is_in_handler = true;
+
+    do {
+        has_run = false;
+
+        for (uint irq = 0; irq < IRQ_COUNT; irq++) {
+            if (core->is_pending[irq] && core->is_enabled[irq] && (core->handlers[irq] != NULL)) {
+                core->is_pending[irq] = false;
+                core->handlers[irq]();
+                has_run = true;
+            }
+        }
+    } while (has_run);
+
+    core->is_in_handler = false;
+}
+
+static void raise_irq(const uint irq) {
+    cores[core_number].is_pending[irq] = true;
+    run_pending_handlers();
+}
+
+uint32_t save_and_disable_interrupts(void) {
+    return cores[core_number].disable_depth++;
+}
+
+void restore_interrupts(uint32_t status) {
+    cores[core_number].disable_depth = status;
+    run_pending_handlers();
+}
+
+void irq_set_exclusive_handler(uint irq, irq_handler_t handler) {
+    cores[core_number].handlers[irq] = handler;
+}
+
+void irq_set_enabled(uint irq, bool enabled) {
+    cores[core_number].is_enabled[irq] = enabled;
+    run_pending_handlers();
+}
+
+// Spin locks, one mutex each
+
+int spin_lock_claim_unused(bool required) {
+    for (int lock = 0; lock < SPIN_LOCK_COUNT; lock++) {
+        if (!spin_locks[lock].is_claimed) {
+            spin_locks[lock].is_claimed = true;
+            return lock;
+        }
+    }
+
+    return -1;
+}
+
+spin_lock_t* spin_lock_init(uint lock_number) {
+    pthread_mutex_init(&spin_locks[lock_number].mutex, NULL);
+    return &spin_locks[lock_number];
+}
+
+uint32_t spin_lock_blocking(spin_lock_t* lock) {
+    uint32_t interrupts = save_and_disable_interrupts();
+
+    pthread_mutex_lock(&lock->mutex);
+    return interrupts;
+}
+
+void spin_unlock(spin_lock_t* lock, uint32_t saved_interrupts) {
+    pthread_mutex_unlock(&lock->mutex);
+    restore_interrupts(saved_interrupts);
+}
+
+// Cores
+
+uint get_core_num(void) {
+    return core_number;
+}
+
+static void* run_core1(void* entry) {
+    core_number = 1;
+    ((void (*)(void)) entry)();
+
+    return NULL;
+}
+
+void multicore_launch_core1(void (*entry)(void)) {
+    pthread_t thread;
+
+    pthread_create(&thread, NULL, run_core1, (void*) entry);
+}
+
+// GPIO
+
+// the callback runs on the thread that changes the pin, which stands in for the core it was enabled on
+static void raise_gpio_irq(const uint gpio_number, const uint32_t event) {
+    if ((gpio.irq_events[gpio_number] & event) && (gpio.callbacks[gpio.irq_cores[gpio_number]] != NULL)) {
+        gpio.callbacks[gpio.irq_cores[gpio_number]](gpio_number, event);
+    }
+}
+
+void host_set_inputs(const uint32_t levels) {
+    uint32_t changed = gpio.inputs ^ levels;
+
+    gpio.inputs = levels;
+
+    for (uint gpio_number = 0; gpio_number < GPIO_COUNT; gpio_number++) {
+        if (changed & (1u << gpio_number)) {
+            raise_gpio_irq(gpio_number, ((levels >> gpio_number) & 0b1) ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL);
+        }
+    }
+}
+
+void gpio_init(uint gpio_number) {
+}
+
+void gpio_set_dir(uint gpio_number, bool out) {
+}
+
+void gpio_set_function(uint gpio_number, enum gpio_function function) {
+}
+
+void gpio_pull_down(uint gpio_number) {
+}
+
+void gpio_put(uint gpio_number, bool value) {
+    gpio.outputs = value ? (gpio.outputs | (1u << gpio_number)) : (gpio.outputs & ~(1u << gpio_number));
+}
+
+bool gpio_get(uint gpio_number) {
+    return (gpio.inputs >> gpio_number) & 0b1;
+}
+
+uint32_t gpio_get_all(void) {
+    return gpio.inputs;
+}
+
+static void* run_tearing_signal(void* argument) {
+    for (;;) {
+        sleep_us(1000000 / HOST_PANEL_REFRESH_RATE);
+        raise_gpio_irq(HOST_PANEL_TE_PIN, GPIO_IRQ_EDGE_RISE);
+    }
+
+    return NULL;
+}
+
+// the tearing effect pin of the panel changes on its own, pulsing at every refresh from a thread of its own
+void gpio_set_irq_enabled(uint gpio_number, uint32_t events, bool enabled) {
+    pthread_t thread;
+
+    gpio.irq_events[gpio_number] = enabled ? (gpio.irq_events[gpio_number] | events) : (gpio.irq_events[gpio_number] & ~events);
+    gpio.irq_cores[gpio_number]  = core_number;
+
+    if ((gpio_number == HOST_PANEL_TE_PIN) && enabled && (events & GPIO_IRQ_EDGE_RISE) && !gpio.is_tearing) {
+        gpio.is_tearing = true;
+        pthread_create(&thread, NULL, run_tearing_signal, NULL);
+    }
+}
+
+void gpio_set_irq_enabled_with_callback(uint gpio_number, uint32_t events, bool enabled, gpio_irq_callback_t callback) {
+    gpio.callbacks[core_number] = callback;
+    gpio_set_irq_enabled(gpio_number, events, enabled);
+}
+
+// SPI, everything written goes to the panel
+
+uint spi_init(spi_inst_t* spi, uint baudrate) {
+    return baudrate;
+}
+
+int spi_write_blocking(spi_inst_t* spi, const uint8_t* source, size_t length) {
+    bool is_data = (gpio.outputs >> HOST_PANEL_DC_PIN) & 0b1;
+
+    for (size_t index = 0; index < length; index++) {
+        panel_write(is_data, source[index]);
+    }
+
+    return length;
+}
+
+int spi_read_blocking(spi_inst_t* spi, uint8_t repeated_data, uint8_t* target, size_t length) {
+    memset(target, 0, length);
+    return length;
+}
+
+bool spi_is_busy(const spi_inst_t* spi) {
+    return false;
+}
+
+spi_hw_t* spi_get_hw(spi_inst_t* spi) {
+    return &spi->hw;
+}
+
+uint spi_get_dreq(spi_inst_t* spi, bool is_tx) {
+    return 0;
+}
+
+// PIO, only the display program is known: the stream is decoded to panel writes the way it would go out
+
+int pio_claim_unused_sm(PIO pio, bool required) {
+    for (int sm = 0; sm < PIO_SM_COUNT; sm++) {
+        if (!pio_sms[sm].is_claimed) {
+            pio_sms[sm].is_claimed = true;
+            return sm;
+        }
+    }
+
+    return -1;
+}
+
+uint pio_add_program(PIO pio, const pio_program_t* program) {
+    return 0;
+}
+
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data) {
+    uint16_t entry = data >> 16;
+
+    switch (pio_sms[sm].header_entries) {
+        case 0:
+            pio_sms[sm].command        = entry >> 8;
+            pio_sms[sm].header_entries = 1;
+            return;
+
+        case 1:
+            pio_sms[sm].data_bits      = (uint32_t) entry << 16;
+            pio_sms[sm].header_entries = 2;
+            return;
+
+        case 2:
+            pio_sms[sm].data_bits |= entry;
+            panel_write(false, pio_sms[sm].command);
+
+            pio_sms[sm].header_entries = (pio_sms[sm].data_bits > 0) ? 3 : 0;
+            return;
+    }
+
+    // the second byte of the last entry may be padding
+    panel_write(true, entry >> 8);
+    pio_sms[sm].data_bits -= 8;
+
+    if (pio_sms[sm].data_bits > 0) {
+        panel_write(true, entry & 0xFF);
+        pio_sms[sm].data_bits -= 8;
+    }
+
+    if (pio_sms[sm].data_bits == 0) {
+        pio_sms[sm].header_entries = 0;
+    }
+}
+
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx) {
+    return 0;
+}
+
+// DMA, only 8-bit transfers to the SPI data register, 16-bit ones to a PIO TX FIFO and control blocks (a count and
+// a read address, the layout of the two registers they go to) for another channel are carried out
+
+int dma_claim_unused_channel(bool required) {
+    for (int channel = 0; channel < DMA_CHANNEL_COUNT; channel++) {
+        if (!dma_channels[channel].is_claimed) {
+            dma_channels[channel].is_claimed = true;
+            return channel;
+        }
+    }
+
+    return -1;
+}
+
+dma_channel_config dma_channel_get_default_config(uint channel) {
+    return (dma_channel_config) {DMA_SIZE_32};
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config* config, enum dma_channel_transfer_size size) {
+    config->ctrl = size;
+}
+
+void channel_config_set_bswap(dma_channel_config* config, bool is_byte_swapped) {
+    config->is_byte_swapped = is_byte_swapped;
+}
+
+void channel_config_set_dreq(dma_channel_config* config, uint dreq) {
+}
+
+void channel_config_set_read_increment(dma_channel_config* config, bool is_incremented) {
+}
+
+void channel_config_set_write_increment(dma_channel_config* config, bool is_incremented) {
+}
+
+void channel_config_set_ring(dma_channel_config* config, bool is_write, uint size_bits) {
+}
+
+void channel_config_set_chain_to(dma_channel_config* config, uint channel) {
+}
+
+void channel_config_set_irq_quiet(dma_channel_config* config, bool is_quiet) {
+    config->is_irq_quiet = is_quiet;
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config* config, volatile void* write_address, const volatile void* read_address,
+                           uint transfer_count, bool trigger) {
+    dma_channels[channel].config         = *config;
+    dma_channels[channel].write_address  = write_address;
+    dma_channels[channel].transfer_count = transfer_count;
+
+    if (trigger) {
+        dma_channel_transfer_from_buffer_now(channel, read_address, transfer_count);
+    }
+}
+
+static void raise_channel_irq(const uint channel) {
+    if (dma_channels[channel].is_irq0_enabled) {
+        dma_channels[channel].is_irq0_pending = true;
+        raise_irq(DMA_IRQ_0);
+    }
+}
+
+static void copy_data(const uint channel, const volatile void* read_address, const uint32_t transfer_count) {
+    if ((dma_channels[channel].write_address == &host_spi.hw.dr) && (dma_channels[channel].config.ctrl == DMA_SIZE_8)) {
+        spi_write_blocking(&host_spi, (const uint8_t*) read_address, transfer_count);
+    }
+
+    for (uint sm = 0; sm < PIO_SM_COUNT; sm++) {
+        if ((dma_channels[channel].write_address == &host_pio0.txf[sm]) && (dma_channels[channel].config.ctrl == DMA_SIZE_16)) {
+            for (uint32_t index = 0; index < transfer_count; index++) {
+                uint16_t value = ((const uint16_t*) read_address)[index];
+
+                // a 16-bit write fills both halves of the FIFO entry
+                value = dma_channels[channel].config.is_byte_swapped ? (value << 8) | (value >> 8) : value;
+                pio_sm_put_blocking(pio0, sm, ((uint32_t) value << 16) | value);
+            }
+        }
+    }
+}
+
+// the data channel of a chain only interrupts on the null block that ends it when it is quiet
+static void run_control_blocks(const uint data_channel, const volatile void* read_address) {
+    const struct {
+            uint32_t  count;
+            uintptr_t read_address;
+    }* block = (const void*) read_address;
+
+    for (; block->read_address != 0; block++) {
+        copy_data(data_channel, (const void*) block->read_address, block->count);
+
+        if (!dma_channels[data_channel].config.is_irq_quiet) {
+            raise_channel_irq(data_channel);
+        }
+    }
+
+    if (dma_channels[data_channel].config.is_irq_quiet) {
+        raise_channel_irq(data_channel);
+    }
+}
+
+void dma_channel_transfer_from_buffer_now(uint channel, const volatile void* read_address, uint32_t transfer_count) {
+    for (uint target = 0; target < DMA_CHANNEL_COUNT; target++) {
+        if (dma_channels[channel].write_address == &host_dma.ch[target].al3_transfer_count) {
+            run_control_blocks(target, read_address);
+            return;
+        }
+    }
+
+    copy_data(channel, read_address, transfer_count);
+
+    if (!dma_channels[channel].config.is_irq_quiet) {
+        raise_channel_irq(channel);
+    }
+}
+
+void dma_channel_set_read_addr(uint channel, const volatile void* read_address, bool trigger) {
+    if (trigger) {
+        dma_channel_transfer_from_buffer_now(channel, read_address, dma_channels[channel].transfer_count);
+    }
+}
+
+void dma_channel_set_irq0_enabled(uint channel, bool enabled) {
+    dma_channels[channel].is_irq0_enabled = enabled;
+}
+
+bool dma_channel_get_irq0_status(uint channel) {
+    return dma_channels[channel].is_irq0_pending;
+}
+
+void dma_channel_acknowledge_irq0(uint channel) {
+    dma_channels[channel].is_irq0_pending = false;
+}
@@ -5,14 +5,56 @@
 
 // Display
 
-#define DISPLAY_WIDTH  320
-#define DISPLAY_HEIGHT 240
+#define DISPLAY_WIDTH        320
+#define DISPLAY_HEIGHT       240
+#define DISPLAY_REFRESH_RATE 70
+
+// The panel refreshes one line of its memory at a time, which with the rotation set by display_init() sweeps the
+// screen from its right edge to the left one.
+#define DISPLAY_SCANS_RIGHT_TO_LEFT 1
 
 uint display_init(void);
 void display_clear(const uint16_t color);
 void display_set_pixel(const uint16_t x, const uint16_t y, const uint16_t color);
 void display_blit(const uint16_t x, const uint16_t y, const uint16_t w, const uint16_t h, uint16_t* data);
 
+// Async transfers: the data must stay untouched until display_is_done() returns true for the returned ticket.
+// Lines of the window are stride pixels apart in data. When a line function is given it produces each of the
+// w pixels wide window lines on the fly (from the interrupt handler), either in the buffer or by returning a
+// pointer into data, and data may hold any pixel format the function understands.
+//
+// The transfers queued between display_begin_list() and display_end_list() wait for the end of the list, which
+// (on the PIO bus) goes out as one DMA chain. Waiting for one of them before the list ends never returns.
+
+typedef const uint16_t*(display_line_function)(const void* data, const uint16_t stride, const uint16_t w, const uint16_t line, uint16_t* buffer);
+
+uint32_t display_blit_async(const uint16_t x, const uint16_t y, const uint16_t w, const uint16_t h, const uint16_t stride, const void* data, display_line_function* line_function);
+bool     display_is_done(const uint32_t ticket);
+void     display_wait(const uint32_t ticket);
+void     display_wait_all(void);
+void     display_begin_list(void);
+void     display_end_list(void);
+
+// Bus traffic, counted as it goes out and closed by display_end_frame() (the GPU calls it at every sync that
+// flushes a frame). Transfers still running at that point are counted in the next frame.
+
+typedef struct {
+        uint32_t commands;           // command bytes
+        uint32_t parameter_bytes;    // sent with the commands, mostly window addresses
+        uint32_t windows;            // address windows set
+        uint32_t pixel_bytes;
+        uint32_t busy_time;          // microseconds the bus spent on transfers
+} display_stats;
+
+void display_end_frame(void);
+void display_get_frame_stats(display_stats* stats);
+
+// Vertical blanks, counted from the tearing effect pulses of the panel. display_wait_vblank() returns false when
+// no pulse comes in time (the TE pin is not wired, or the build has no GPU_TEAR_SYNC to listen to it).
+
+uint32_t display_get_vblank_count(void);
+bool     display_wait_vblank(const uint32_t count);
+
 // GPU
 
 #define GPU_RESOLUTION_WIDTH  160
@@ -43,19 +85,122 @@ void display_blit(const uint16_t x, const uint16_t y, const uint16_t w, const ui
 
 #define GPU_PRINT_RIGHT 5000
 
+#define GPU_SCALE_1X 1
+#define GPU_SCALE_2X 2
+
+#ifndef GPU_COMMAND_RING_SIZE
+    #define GPU_COMMAND_RING_SIZE 1024    // words, shared by all queued commands
+#endif
+
+#ifndef GPU_MAX_LISTS
+    #define GPU_MAX_LISTS 8
+#endif
+
+#ifndef GPU_MAX_SPRITES
+    #define GPU_MAX_SPRITES 32
+#endif
+
+#define GPU_SPRITE_FLIP_X 1
+#define GPU_SPRITE_FLIP_Y 2
+
+#ifndef GPU_MAX_SHEETS
+    #define GPU_MAX_SHEETS 4
+#endif
+
+// Every row of an RLE image is a list of runs that add up to the image width. A run byte below
+// GPU_RLE_OPAQUE_RUN skips (byte + 1) transparent pixels, from it on it is followed by ((byte & 0x7F) + 1)
+// color indices.
+#define GPU_RLE_OPAQUE_RUN 0x80
+
+// A sheet is cut into GPU_TILE_WIDTH x GPU_TILE_HEIGHT tiles, numbered row by row. The map of a tilemap holds one
+// tile per byte and gpu_set_tile() writes to it, so it has to be in RAM (not a cartridge asset, which is in flash).
+#define GPU_TILE_WIDTH  8
+#define GPU_TILE_HEIGHT 8
+
+#ifndef GPU_MAX_FONTS
+    #define GPU_MAX_FONTS 4
+#endif
+
+#ifndef GPU_MAX_TEXTS
+    #define GPU_MAX_TEXTS 16
+#endif
+
+#ifndef GPU_TEXT_ARENA_SIZE
+    #define GPU_TEXT_ARENA_SIZE 1024    // bytes, every text takes three times its capacity
+#endif
+
+// A sync that comes before its frame is due is dropped, and what it drew shows with the next frame. When core1
+// falls behind, cpu_run() holds core0 back while more than GPU_MAX_QUEUED_FRAMES frames wait in the ring. A frame
+// is skipped without being rasterized (only its state changes apply) when a newer one that starts with a clear is
+// already queued behind it. gpu_init() returns the rate the frames are presented at, and gpu_wait_for_step() holds
+// core0 until its next step: on the vertical blanks the frames are presented on with GPU_TEAR_SYNC, on its own clock
+// otherwise.
+//
+// Built with GPU_SPLIT_RASTER, core1 bins the drawing commands by framebuffer cell and both cores rasterize the
+// cells, core0 while it is in gpu_assist() or waiting for core1.
+#define GPU_MAX_QUEUED_FRAMES 2
+
+typedef struct {
+        uint32_t presented;
+        uint32_t dropped;             // synced before they were due
+        uint32_t skipped;             // not rasterized, a newer frame was already queued
+        uint32_t late;                // flushed more than a frame time after their sync
+        uint32_t throttled;           // core0 steps held back
+        uint32_t last_latency;        // microseconds from the sync to the flush of the last presented frame
+        uint32_t rasterized_cells;    // with GPU_SPLIT_RASTER
+        uint32_t assisted_cells;      // rasterized by core0
+} gpu_frame_stats;
+
+#define GPU_FONT_MAX_GLYPHS      128
+#define GPU_FONT_MAX_CHAR_WIDTH  8
+#define GPU_FONT_MAX_CHAR_HEIGHT 8
+
 typedef void* gpu_sheet;
+typedef void* gpu_list;
+typedef void* gpu_font;
+typedef void* gpu_text;
 
-void     gpu_init(const uint8_t max_fps);
-void     gpu_clear();
-void     gpu_set_background_color(const uint8_t color);
-void     gpu_set_foreground_color(const uint8_t color);
-void     gpu_set_palette(const uint8_t palette_index);
-void     gpu_set_pixel(const uint16_t x, const uint16_t y, const uint8_t color);
-void     gpu_blit(const uint16_t x, const uint16_t y, const uint16_t w, const uint16_t h, uint8_t* data);
-void     gpu_print_small(const uint16_t x, const uint16_t y, const char* text, ...);
-void     gpu_sync(void);
-uint64_t gpu_get_last_frame_time(void);
-uint64_t gpu_get_last_busy_time(void);
+uint8_t   gpu_init(const uint8_t max_fps);
+void      gpu_clear();
+void      gpu_set_background_color(const uint8_t color);
+void      gpu_set_foreground_color(const uint8_t color);
+void      gpu_set_palette(const uint8_t palette_index);
+void      gpu_set_scale(const uint8_t scale);
+void      gpu_set_pixel(const uint16_t x, const uint16_t y, const uint8_t color);
+void      gpu_blit(const int16_t x, const int16_t y, const uint16_t w, const uint16_t h, const uint8_t* data);
+void      gpu_blit_opaque(const int16_t x, const int16_t y, const uint16_t w, const uint16_t h, const uint8_t* data);
+void      gpu_blit_rle(const int16_t x, const int16_t y, const uint16_t w, const uint16_t h, const uint8_t* data);
+gpu_font  gpu_create_font(const uint8_t* bitmap, const uint16_t w, const uint16_t h, const uint8_t char_width, const uint8_t char_height);
+void      gpu_set_font(gpu_font font);
+void      gpu_print_small(const uint16_t x, const uint16_t y, const char* text, ...);
+gpu_text  gpu_create_text(const uint8_t capacity);
+void      gpu_set_text(gpu_text text, const uint16_t x, const uint16_t y, const uint8_t color, const char* format, ...);
+void      gpu_hide_text(gpu_text text);
+void      gpu_sync(void);
+void      gpu_begin_batch(void);
+void      gpu_end_batch(void);
+uint16_t  gpu_get_command_ring_usage(void);
+uint16_t  gpu_get_command_ring_peak_usage(void);
+gpu_list  gpu_create_list(uint32_t* buffer, const uint16_t size);
+void      gpu_begin_list(gpu_list list);
+bool      gpu_end_list(void);
+uint16_t  gpu_get_list_position(void);
+void      gpu_patch_list_position(gpu_list list, const uint16_t position, const uint16_t x, const uint16_t y);
+void      gpu_call_list(gpu_list list);
+void      gpu_set_sprite(const uint8_t index, const int16_t x, const int16_t y, const uint16_t w, const uint16_t h, const uint8_t* data, const uint8_t flags,
+                         const uint8_t palette_index, const uint8_t priority);
+void      gpu_move_sprite(const uint8_t index, const int16_t x, const int16_t y);
+void      gpu_hide_sprite(const uint8_t index);
+gpu_sheet gpu_create_sheet(const uint8_t* data, const uint16_t w, const uint16_t h);
+void      gpu_set_tilemap(gpu_sheet sheet, uint8_t* map, const uint16_t columns, const uint16_t rows);
+void      gpu_scroll_tilemap(const uint16_t x, const uint16_t y);
+void      gpu_set_tile(const uint16_t column, const uint16_t row, const uint8_t tile);
+uint64_t  gpu_get_last_frame_time(void);
+uint64_t  gpu_get_last_busy_time(void);
+void      gpu_wait_for_frames(void);
+void      gpu_assist(const uint64_t until);
+void      gpu_wait_for_step(const uint64_t until);
+void      gpu_get_frame_stats(gpu_frame_stats* stats);
 
 // CPU
 
@@ -77,10 +222,172 @@ uint64_t cpu_get_last_cycle_time(void);
 #define IPU_BUTTON_A     6
 #define IPU_BUTTON_B     7
 
-#define IPU_BUTTON_PRESSED(button) ((ipu_get_state() >> button) & 0b1)
+// The buttons are sampled by the gpio interrupt as they change, debounced and queued with the time of the edge.
+// ipu_read() takes in the queued events once per step: a press shorter than a step still shows as held for that
+// step, and the buttons pressed or released since the last read are kept apart.
+#define IPU_EVENT_QUEUE_SIZE 32
+#define IPU_DEBOUNCE_TIME    5000    // microseconds
+
+typedef struct {
+        uint32_t time;    // time_us_32() of the edge
+        uint8_t  button;
+        bool     is_pressed;
+} ipu_event;
+
+#define IPU_BUTTON_PRESSED(button)       ((ipu_get_state() >> button) & 0b1)
+#define IPU_BUTTON_JUST_PRESSED(button)  ((ipu_get_pressed() >> button) & 0b1)
+#define IPU_BUTTON_JUST_RELEASED(button) ((ipu_get_released() >> button) & 0b1)
+
+void             ipu_init(void);
+uint8_t          ipu_read(void);
+uint8_t          ipu_get_state(void);
+uint8_t          ipu_get_pressed(void);
+uint8_t          ipu_get_released(void);
+uint32_t         ipu_get_held_time(const uint8_t button);
+const ipu_event* ipu_get_events(uint8_t* count);
+
+// Recording and replay: ipu_record() keeps the state, pressed and released buttons of every ipu_read() in a RAM
+// buffer, ipu_replay() feeds such a stream back to ipu_read() in place of the buttons (held times and events stay
+// empty), so the same steps can be run again. The stream is the magic and the seed (little endian words) followed by
+// runs of {steps, state, pressed, released}. Games take their random seed from ipu_get_seed(), which comes from the
+// stream once one is recorded or replayed. A finished replay leaves every button released.
+#define IPU_RECORD_MAGIC       0x31525049    // "IPR1"
+#define IPU_RECORD_HEADER_SIZE 8             // bytes
+#define IPU_RECORD_RUN_SIZE    4             // bytes
+#define IPU_RECORD_SIZE        4096          // bytes, of the buffer main() records into
+
+#define IPU_MODE_LIVE     0
+#define IPU_MODE_RECORD   1
+#define IPU_MODE_REPLAY   2
+#define IPU_MODE_REPLAYED 3    // the replay has ended
+
+bool           ipu_record(uint8_t* buffer, const uint32_t size);
+bool           ipu_replay(const uint8_t* stream, const uint32_t size);
+uint8_t        ipu_get_mode(void);
+const uint8_t* ipu_get_record(uint32_t* size);
+uint32_t       ipu_get_seed(void);
+
+// Cartridge: a game and its assets packed by tools/cart.py. The image is read in place from the cartridge flash
+// partition (or from the one built into the firmware when the partition holds none), so asset data points straight
+// into XIP flash and is never copied.
+
+#ifndef CART_FLASH_OFFSET
+    #define CART_FLASH_OFFSET (1024 * 1024)
+#endif
+
+#ifndef CART_FLASH_SIZE
+    #define CART_FLASH_SIZE (1024 * 1024)
+#endif
+
+#define CART_NAME_LENGTH 16
+
+#define CART_ASSET_OPAQUE 0    // raw indices, for gpu_blit_opaque()
+#define CART_ASSET_KEYED  1    // raw indices, for gpu_blit()
+#define CART_ASSET_RLE    2    // RLE rows, for gpu_blit_rle()
+#define CART_ASSET_FONT   3    // 1bpp rows, for gpu_create_font()
+#define CART_ASSET_DATA   4    // anything else
+
+typedef struct {
+        const uint8_t* data;
+        uint32_t       size;
+        uint16_t       w;
+        uint16_t       h;
+        uint8_t        format;
+} cart_asset;
+
+bool        cart_init(void);
+bool        cart_is_builtin(void);
+const char* cart_get_game(void);
+bool        cart_find_asset(const char* name, cart_asset* asset);
+bool        cart_get_asset(const uint16_t index, cart_asset* asset);
+void        cart_blit_asset(const cart_asset* asset, const int16_t x, const int16_t y);
+
+// VM: a stack machine for the code of a cartridge, run by vm_step() on core0. Values are 32-bit signed integers,
+// instructions are one opcode byte followed by their operands (little endian). Addresses are absolute offsets into
+// the code. Each step runs until a YIELD, a HALT or until it has gone through VM_STEP_BUDGET bytes of code, which is
+// only checked on jumps, calls and returns, so straight code runs with no accounting at all.
+
+#ifndef VM_STACK_SIZE
+    #define VM_STACK_SIZE 64    // values
+#endif
+
+#ifndef VM_CALL_DEPTH
+    #define VM_CALL_DEPTH 16
+#endif
+
+#ifndef VM_STEP_BUDGET
+    #define VM_STEP_BUDGET 65536    // bytes of code
+#endif
+
+#define VM_GLOBAL_COUNT 256    // a power of two, LOADI and STOREI wrap around
+
+#define VM_STATE_HALTED  0
+#define VM_STATE_RUNNING 1
+#define VM_STATE_FAULTED 2
+
+#define VM_OP_HALT   0     //
+#define VM_OP_YIELD  1     // ends the step, the next one starts at the following instruction
+#define VM_OP_PUSH8  2     // int8 > value
+#define VM_OP_PUSH16 3     // int16 > value
+#define VM_OP_PUSH32 4     // int32 > value
+#define VM_OP_DUP    5     // a > a a
+#define VM_OP_DROP   6     // a >
+#define VM_OP_SWAP   7     // a b > b a
+#define VM_OP_OVER   8     // a b > a b a
+#define VM_OP_LOAD   9     // uint8 global > value
+#define VM_OP_STORE  10    // uint8 global, value >
+#define VM_OP_LOADI  11    // index > value
+#define VM_OP_STOREI 12    // value index >
+#define VM_OP_ADD    13    // a b > a + b
+#define VM_OP_SUB    14    // a b > a - b
+#define VM_OP_MUL    15    // a b > a * b
+#define VM_OP_DIV    16    // a b > a / b
+#define VM_OP_MOD    17    // a b > a % b
+#define VM_OP_AND    18    // a b > a & b
+#define VM_OP_OR     19    // a b > a | b
+#define VM_OP_XOR    20    // a b > a ^ b
+#define VM_OP_SHL    21    // a b > a << b
+#define VM_OP_SHR    22    // a b > a >> b (arithmetic)
+#define VM_OP_NEG    23    // a > -a
+#define VM_OP_NOT    24    // a > ~a
+#define VM_OP_EQ     25    // a b > a == b
+#define VM_OP_NE     26    // a b > a != b
+#define VM_OP_LT     27    // a b > a < b
+#define VM_OP_LE     28    // a b > a <= b
+#define VM_OP_GT     29    // a b > a > b
+#define VM_OP_GE     30    // a b > a >= b
+#define VM_OP_JMP    31    // uint16 address
+#define VM_OP_JZ     32    // uint16 address, a >
+#define VM_OP_JNZ    33    // uint16 address, a >
+#define VM_OP_CALL   34    // uint16 address
+#define VM_OP_RET    35    //
+#define VM_OP_SYS    36    // uint8 syscall, arguments > result (if any)
+
+#define VM_OP_COUNT 37
+
+// syscalls, the arguments are pushed in order and the assets are cartridge index entries
+#define VM_SYS_SYNC           0     // gpu_sync()
+#define VM_SYS_CLEAR          1     // gpu_clear()
+#define VM_SYS_SET_BACKGROUND 2     // gpu_set_background_color(color)
+#define VM_SYS_SET_FOREGROUND 3     // gpu_set_foreground_color(color)
+#define VM_SYS_SET_PALETTE    4     // gpu_set_palette(palette)
+#define VM_SYS_SET_SCALE      5     // gpu_set_scale(scale)
+#define VM_SYS_SET_PIXEL      6     // gpu_set_pixel(x, y, color)
+#define VM_SYS_BLIT_ASSET     7     // cart_blit_asset(asset, x, y)
+#define VM_SYS_PRINT          8     // gpu_print_small(x, y, text, value), text is the code address of a C string
+#define VM_SYS_SET_SPRITE     9     // gpu_set_sprite(sprite, x, y, asset, flags, palette, priority)
+#define VM_SYS_MOVE_SPRITE    10    // gpu_move_sprite(sprite, x, y)
+#define VM_SYS_HIDE_SPRITE    11    // gpu_hide_sprite(sprite)
+#define VM_SYS_READ_BUTTONS   12    // ipu_read() > state
+#define VM_SYS_GET_BUTTONS    13    // ipu_get_state() > state
+#define VM_SYS_GET_TIME       14    // time_us_32() > microseconds
+#define VM_SYS_GET_PRESSED    15    // ipu_get_pressed() > buttons
+#define VM_SYS_GET_RELEASED   16    // ipu_get_released() > buttons
+#define VM_SYS_GET_SEED       17    // ipu_get_seed() > seed
 
-void    ipu_init(void);
-uint8_t ipu_read(void);
-uint8_t ipu_get_state(void);
+bool     vm_load(const uint8_t* code, const uint32_t size);
+void     vm_step(void);
+uint8_t  vm_get_state(void);
+uint32_t vm_get_fault_address(void);
 
 #endif
\ No newline at end of file
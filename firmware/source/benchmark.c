@@ -0,0 +1,142 @@
+#include "api.h"
+#include "pico/stdlib.h"
+
+#include <stdio.h>
+
+#define BENCHMARK_START_DELAY 3000    // ms, time for the usb serial port to come up
+#define BENCHMARK_PIXELS      1000000 // per size and variant
+#define BENCHMARK_MAX_SIZE    64
+#define BENCHMARK_VM_LOOPS    200000
+#define BENCHMARK_VM_LOOP_OPS 16
+
+typedef void(blit_function)(const int16_t x, const int16_t y, const uint16_t w, const uint16_t h, const uint8_t* data);
+
+static const uint16_t sizes[] = {8, 16, 32, 64};
+
+static uint8_t opaque_data[BENCHMARK_MAX_SIZE * BENCHMARK_MAX_SIZE];
+static uint8_t keyed_data[BENCHMARK_MAX_SIZE * BENCHMARK_MAX_SIZE];
+static uint8_t rle_data[BENCHMARK_MAX_SIZE * BENCHMARK_MAX_SIZE * 2];
+
+// acc = ((acc * 3) + i) ^ (i >> 2) for i from BENCHMARK_VM_LOOPS down to 1, a mix of stack, global, arithmetic and
+// branch instructions close to what game logic runs
+static const uint8_t vm_workload[] = {
+    VM_OP_PUSH32, BENCHMARK_VM_LOOPS & 0xFF, (BENCHMARK_VM_LOOPS >> 8) & 0xFF, (BENCHMARK_VM_LOOPS >> 16) & 0xFF, BENCHMARK_VM_LOOPS >> 24,
+    VM_OP_STORE, 0,
+    // 7: loop
+    VM_OP_LOAD, 1, VM_OP_PUSH8, 3, VM_OP_MUL, VM_OP_LOAD, 0, VM_OP_ADD,
+    VM_OP_LOAD, 0, VM_OP_PUSH8, 2, VM_OP_SHR, VM_OP_XOR, VM_OP_STORE, 1,
+    VM_OP_LOAD, 0, VM_OP_PUSH8, 1, VM_OP_SUB, VM_OP_DUP, VM_OP_STORE, 0,
+    VM_OP_JNZ, 7, 0,
+    VM_OP_HALT};
+
+static void encode_rle(const uint8_t* source, const uint16_t w, const uint16_t h, uint8_t* target) {
+    uint16_t run_length;
+    bool     is_opaque;
+
+    for (uint16_t y = 0; y < h; y++) {
+        for (uint16_t x = 0; x < w; x += run_length) {
+            is_opaque  = source[x] != 0;
+            run_length = 1;
+
+            while ((x + run_length < w) && ((source[x + run_length] != 0) == is_opaque) && (run_length < GPU_RLE_OPAQUE_RUN)) {
+                run_length++;
+            }
+
+            if (is_opaque) {
+                *target++ = GPU_RLE_OPAQUE_RUN | (run_length - 1);
+
+                for (uint16_t run_x = 0; run_x < run_length; run_x++) {
+                    *target++ = source[x + run_x];
+                }
+            } else {
+                *target++ = run_length - 1;
+            }
+        }
+
+        source += w;
+    }
+}
+
+// Returns the fill rate in pixels per microsecond. The blits are queued as fast as the ring takes them and the
+// clock stops once core1 has drained it, so the command overhead is part of the figure.
+static float measure_fill_rate(const uint16_t size, const uint8_t* data, blit_function* blit) {
+    uint32_t blit_count = BENCHMARK_PIXELS / (size * size);
+    uint64_t start      = time_us_64();
+
+    for (uint32_t blit_index = 0; blit_index < blit_count; blit_index++) {
+        // walks the whole screen, partly off the edges too
+        blit((int16_t) ((blit_index * 37) % (GPU_RESOLUTION_WIDTH + size)) - (size / 2),
+             (int16_t) ((blit_index * 23) % (GPU_RESOLUTION_HEIGHT + size)) - (size / 2),
+             size,
+             size,
+             data);
+    }
+
+    // core0 rasterizes too when the gpu splits the work
+    while (gpu_get_command_ring_usage() > 0) {
+        gpu_assist(time_us_64() + 1);
+    }
+
+    return (float) (blit_count * size * size) / (float) (time_us_64() - start);
+}
+
+// Returns the interpreter speed in millions of instructions per second, the step budget is part of the figure.
+static float measure_vm() {
+    uint64_t start;
+
+    vm_load(vm_workload, sizeof(vm_workload));
+    start = time_us_64();
+
+    while (vm_get_state() == VM_STATE_RUNNING) {
+        vm_step();
+    }
+
+    return (float) (3 + (BENCHMARK_VM_LOOPS * BENCHMARK_VM_LOOP_OPS)) / (float) (time_us_64() - start);
+}
+
+void benchmark_run() {
+    float opaque_rates[count_of(sizes)], keyed_rates[count_of(sizes)], rle_rates[count_of(sizes)], vm_rate;
+
+    stdio_init_all();
+    sleep_ms(BENCHMARK_START_DELAY);
+
+    for (uint16_t index = 0; index < BENCHMARK_MAX_SIZE * BENCHMARK_MAX_SIZE; index++) {
+        opaque_data[index] = (uint8_t) (index | 1);
+        keyed_data[index]  = (index & 0b1000) ? (uint8_t) index : 0;    // half of the pixels are transparent
+    }
+
+    printf("blit fill rate (pixels/us)\n");
+
+    for (uint8_t size_index = 0; size_index < count_of(sizes); size_index++) {
+        encode_rle(keyed_data, sizes[size_index], sizes[size_index], rle_data);
+
+        opaque_rates[size_index] = measure_fill_rate(sizes[size_index], opaque_data, gpu_blit_opaque);
+        keyed_rates[size_index]  = measure_fill_rate(sizes[size_index], keyed_data, gpu_blit);
+        rle_rates[size_index]    = measure_fill_rate(sizes[size_index], rle_data, gpu_blit_rle);
+
+        printf("%2dx%-2d opaque %6.2f keyed %6.2f rle %6.2f\n", sizes[size_index], sizes[size_index], opaque_rates[size_index], keyed_rates[size_index],
+               rle_rates[size_index]);
+    }
+
+    vm_rate = measure_vm();
+    printf("vm %.2f Mops/s\n", vm_rate);
+
+    gpu_clear();
+    gpu_print_small(5, 5, "PX/US   OPQ   KEY   RLE");
+
+    // the gpu formatter has no floats, the rates are shown with one decimal
+    for (uint8_t size_index = 0; size_index < count_of(sizes); size_index++) {
+        gpu_print_small(5, 5 + ((size_index + 2) * (GPU_SMALL_CHAR_HEIGHT + 2)), "%2dX%-2d %3d.%d %3d.%d %3d.%d", sizes[size_index], sizes[size_index],
+                        (int) opaque_rates[size_index], (int) (opaque_rates[size_index] * 10) % 10, (int) keyed_rates[size_index],
+                        (int) (keyed_rates[size_index] * 10) % 10, (int) rle_rates[size_index], (int) (rle_rates[size_index] * 10) % 10);
+    }
+
+    gpu_print_small(5, 5 + ((count_of(sizes) + 3) * (GPU_SMALL_CHAR_HEIGHT + 2)), "VM MOPS/S %d.%02d", (int) vm_rate, (int) (vm_rate * 100) % 100);
+
+    gpu_sync();
+
+    // the results stay on screen
+    for (;;) {
+        tight_loop_contents();
+    }
+}
@@ -0,0 +1,140 @@
+#include "api.h"
+#include "hardware/regs/addressmap.h"
+#include "pico/stdlib.h"
+
+#include <string.h>
+
+#define CART_MAGIC   0x54524350    // "PCRT"
+#define CART_VERSION 1
+
+typedef struct {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t asset_count;
+        uint32_t size;
+        uint32_t checksum;
+        char     game[CART_NAME_LENGTH];
+} cart_header;
+
+typedef struct {
+        char     name[CART_NAME_LENGTH];
+        uint32_t offset;
+        uint32_t size;
+        uint16_t w;
+        uint16_t h;
+        uint8_t  format;
+        uint8_t  padding[3];
+} cart_entry;
+
+// the default game, packed at build time
+extern const uint8_t builtin_cart[];
+
+// end of the firmware in flash, from the linker script
+extern char __flash_binary_end;
+
+static struct {
+        const cart_header* header;
+        const cart_entry*  entries;
+        bool               is_builtin;
+} cart;
+
+static bool is_valid_cart(const uint8_t* image, const uint32_t max_size) {
+    const cart_header* header   = (const cart_header*) image;
+    const cart_entry*  entries  = (const cart_entry*) (image + sizeof(cart_header));
+    const uint32_t*    words    = (const uint32_t*) entries;
+    uint32_t           checksum = 0;
+
+    if ((header->magic != CART_MAGIC) || (header->version != CART_VERSION) || (header->size > max_size) || (header->size & 0b11) ||
+        (header->size < sizeof(cart_header) + (header->asset_count * sizeof(cart_entry)))) {
+        return false;
+    }
+
+    for (uint16_t asset_index = 0; asset_index < header->asset_count; asset_index++) {
+        if ((entries[asset_index].offset > header->size) || (entries[asset_index].size > header->size - entries[asset_index].offset)) {
+            return false;
+        }
+    }
+
+    // a cartridge that was only partly written still has a valid header
+    for (uint32_t word_index = 0; word_index < (header->size - sizeof(cart_header)) / 4; word_index++) {
+        checksum += words[word_index];
+    }
+
+    return checksum == header->checksum;
+}
+
+bool cart_init(void) {
+    const uint8_t* image = (const uint8_t*) (XIP_BASE + CART_FLASH_OFFSET);
+
+    // a firmware that grew into the partition would be read as a cartridge
+    cart.is_builtin = ((uintptr_t) &__flash_binary_end > (uintptr_t) image) || !is_valid_cart(image, CART_FLASH_SIZE);
+
+    if (cart.is_builtin) {
+        image = builtin_cart;
+
+        if (!is_valid_cart(image, UINT32_MAX)) {
+            cart.header = NULL;
+            return false;
+        }
+    }
+
+    cart.header  = (const cart_header*) image;
+    cart.entries = (const cart_entry*) (image + sizeof(cart_header));
+
+    return true;
+}
+
+bool cart_is_builtin(void) {
+    return cart.is_builtin;
+}
+
+const char* cart_get_game(void) {
+    return (cart.header != NULL) ? cart.header->game : "";
+}
+
+bool cart_find_asset(const char* name, cart_asset* asset) {
+    if (cart.header == NULL) {
+        return false;
+    }
+
+    for (uint16_t asset_index = 0; asset_index < cart.header->asset_count; asset_index++) {
+        if (strncmp(cart.entries[asset_index].name, name, CART_NAME_LENGTH) == 0) {
+            return cart_get_asset(asset_index, asset);
+        }
+    }
+
+    return false;
+}
+
+bool cart_get_asset(const uint16_t index, cart_asset* asset) {
+    const cart_entry* entry;
+
+    if ((cart.header == NULL) || (index >= cart.header->asset_count)) {
+        return false;
+    }
+
+    entry         = &cart.entries[index];
+    asset->data   = (const uint8_t*) cart.header + entry->offset;
+    asset->size   = entry->size;
+    asset->w      = entry->w;
+    asset->h      = entry->h;
+    asset->format = entry->format;
+
+    return true;
+}
+
+void cart_blit_asset(const cart_asset* asset, const int16_t x, const int16_t y) {
+    switch (asset->format) {
+        case CART_ASSET_OPAQUE:
+            gpu_blit_opaque(x, y, asset->w, asset->h, asset->data);
+            break;
+
+        case CART_ASSET_KEYED:
+            gpu_blit(x, y, asset->w, asset->h, asset->data);
+            break;
+
+        case CART_ASSET_RLE:
+            gpu_blit_rle(x, y, asset->w, asset->h, asset->data);
+            break;
+    }
+}
@@ -20,13 +20,15 @@ void cpu_run(cpu_step_function step_function) {
     uint64_t step_start, step_time;
 
     for (;;) {
+        // frames the gpu cannot keep up with would only be skipped, and would delay the input they show
+        gpu_wait_for_frames();
+
         step_start = time_us_64();
         step_function();
         cpu.time.last_step = time_us_64() - step_start;
 
-        if (cpu.time.last_step < cpu.time.min_cycle) {
-            sleep_us(cpu.time.min_cycle - cpu.time.last_step);
-        }
+        // the rest of the cycle goes to rasterizing for core1, the gpu knows when the next frame is presented
+        gpu_wait_for_step(step_start + cpu.time.min_cycle);
 
         cpu.time.last_cycle = time_us_64() - step_start;
     }
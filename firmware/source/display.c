@@ -1,5 +1,22 @@
 #include "api.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
 #include "hardware/spi.h"
+#include "hardware/sync.h"
+
+#ifndef DISPLAY_PIO_BUS
+    #define DISPLAY_PIO_BUS 0
+#endif
+
+#ifndef GPU_TEAR_SYNC
+    #define GPU_TEAR_SYNC 0
+#endif
+
+#if DISPLAY_PIO_BUS
+    #include "display.pio.h"
+    #include "hardware/clocks.h"
+    #include "hardware/pio.h"
+#endif
 
 #define RX_PIN    4
 #define CS_PIN    5
@@ -7,6 +24,26 @@
 #define TX_PIN    7
 #define DC_PIN    1
 #define RESET_PIN 2
+#define TE_PIN    3
+
+#define TRANSFER_QUEUE_CAPACITY 32
+#define VBLANK_TIMEOUT          (2 * 1000000 / DISPLAY_REFRESH_RATE)
+
+// the pio bus clocks a bit every two cycles, twice the 31.25 MHz the spi peripheral gets out of 32 MHz
+#define PIO_BUS_CLOCK 62500000
+
+// Transaction lists: with the pio bus dc travels with the data, so the windows queued between display_begin_list()
+// and display_end_list() go out as one chain of dma control blocks (the window setup of each, then its rows) and only
+// interrupt at the end. Windows drawn through a line function still need the cpu, they go out on their own.
+#define CHAIN_BLOCK_CAPACITY 256
+#define PREFIX_SIZE          26    // three headers of 6 bytes, two windows of 4
+
+// bytes the dma moves to the bus at a time, the pio takes whole 16-bit entries (see display.pio)
+#if DISPLAY_PIO_BUS
+    #define BUS_WORD_SIZE 2
+#else
+    #define BUS_WORD_SIZE 1
+#endif
 
 static const uint8_t DISPLAY_FUNCTION_CONTROL = 0xB6;
 static const uint8_t DISPLAY_OFF              = 0x28;
@@ -34,43 +71,321 @@ static const uint8_t VCOM_CONTROL_2           = 0xC7;
 static const uint8_t WAKE_UP                  = 0x11;
 static const uint8_t WRITE_MEMORY             = 0x2C;
 
+#if DISPLAY_PIO_BUS
+
+// a command goes out with the number of data bytes that follow it, dc is switched by the state machine
+#define send_header(command, size)                                                          \
+    display.stats.current.commands++;                                                       \
+    pio_sm_put_blocking(pio0, display.pio_sm, (uint32_t) * (const uint8_t*) &command << 24); \
+    pio_sm_put_blocking(pio0, display.pio_sm, ((uint32_t) (size) * 8) & 0xFFFF0000);        \
+    pio_sm_put_blocking(pio0, display.pio_sm, (uint32_t) (size) << 19)
+
+#define send(command) send_header(command, 0)
+
+#define begin_write(size) send_header(WRITE_MEMORY, size)
+
+#define write(data, size) write_entries((const uint8_t*) (data), size)
+
+#define execute(command, data, size)               \
+    send_header(command, size);                    \
+    display.stats.current.parameter_bytes += size; \
+    write(data, size)
+
+#else
+
 #define send(command)                                        \
+    display.stats.current.commands++;                        \
     gpio_put(DC_PIN, 0);                                     \
     spi_write_blocking(spi_default, (uint8_t*) &command, 1); \
     gpio_put(DC_PIN, 1)
 
-#define write(data, size) spi_write_blocking(spi_default, (uint8_t*) data, size)
+#define begin_write(size) send(WRITE_MEMORY)
 
-#define write8(data)  write(&data, 1)
-#define write16(data) write(&data, 2)
+#define write(data, size) spi_write_blocking(spi_default, (uint8_t*) data, size)
 
 #define read(data, size) spi_read_blocking(spi_default, 0x01, (uint8_t*) data, size)
 #define read8(data)      read(&data, 1)
 #define read16(data)     read(&data, 2)
 
-#define execute(command, data, size) \
-    send(command);                   \
+#define execute(command, data, size)               \
+    send(command);                                 \
+    display.stats.current.parameter_bytes += size; \
     write(data, size)
 
+#endif
+
+#define write8(data)  write(&data, 1)
+#define write16(data) write(&data, 2)
+
+static struct {
+        struct {
+                uint16_t    x;
+                uint16_t    y;
+                uint16_t    w;
+                uint16_t    h;
+                uint16_t    stride;
+                const void* data;
+
+                display_line_function* line_function;
+
+#if DISPLAY_PIO_BUS
+                uint16_t prefix[PREFIX_SIZE / 2];    // the window setup as it goes out, for the chain
+#endif
+        } transfers[TRANSFER_QUEUE_CAPACITY];
+
+#if DISPLAY_PIO_BUS
+        // read by the control channel into the data channel, one block at a time
+        struct {
+                struct {
+                        uint32_t  count;
+                        uintptr_t read_address;
+                } blocks[CHAIN_BLOCK_CAPACITY + 1];
+
+                uint     data_channel;
+                uint     control_channel;
+                uint32_t window_count;    // in the chain being sent
+        } chain;
+#endif
+
+        uint16_t        line_buffers[2][DISPLAY_WIDTH] __attribute__((aligned(4)));
+        const uint16_t* next_line;
+        uint16_t        current_line;
+        uint16_t        line_count;
+        uint32_t        line_size;    // in bus words
+
+        volatile uint32_t queued;
+        volatile uint32_t completed;
+        volatile bool     is_active;
+        bool              is_listing;
+        uint              dma_channel;
+#if DISPLAY_PIO_BUS
+        uint              pio_sm;
+#endif
+        uint32_t          transfer_start;
+        volatile uint32_t vblank_count;
+
+        // the current frame is only touched by the core that owns the display, last is read from the other one
+        struct {
+                display_stats     current;
+                display_stats     last;
+                volatile uint32_t sequence;    // odd while last is being written
+        } stats;
+} display;
+
+#if DISPLAY_PIO_BUS
+
+// the data of a transaction, written in one go since an odd byte count is padded to a whole entry
+static void write_entries(const uint8_t* data, const uint32_t size) {
+    for (uint32_t index = 0; index < size; index += 2) {
+        pio_sm_put_blocking(pio0, display.pio_sm, ((uint32_t) data[index] << 24) | ((index + 1 < size) ? (uint32_t) data[index + 1] << 16 : 0));
+    }
+}
+
+#endif
+
 static inline void set_address(const uint16_t x0,
                                const uint16_t y0,
                                const uint16_t x1,
                                const uint16_t y1) {
-    uint16_t sx0 = (x0 << 8) | (x0 >> 8);
-    uint16_t sx1 = (x1 << 8) | (x1 >> 8);
-    uint16_t sy0 = (y0 << 8) | (y0 >> 8);
-    uint16_t sy1 = (y1 << 8) | (y1 >> 8);
+    uint8_t columns[4] = {x0 >> 8, x0 & 0xFF, x1 >> 8, x1 & 0xFF};
+    uint8_t pages[4]   = {y0 >> 8, y0 & 0xFF, y1 >> 8, y1 & 0xFF};
+
+    execute(SET_COLUMN_ADDRESS, columns, 4);
+    execute(SET_PAGE_ADDRESS, pages, 4);
+
+    display.stats.current.windows++;
+}
 
-    send(SET_COLUMN_ADDRESS);
-    write16(sx0);
-    write16(sx1);
+static inline const uint16_t* fetch_line(const uint32_t slot, const uint16_t line) {
+    if (display.transfers[slot].line_function == NULL) {
+        return (const uint16_t*) display.transfers[slot].data + (line * display.transfers[slot].stride);
+    }
+
+    return display.transfers[slot].line_function(
+        display.transfers[slot].data,
+        display.transfers[slot].stride,
+        display.transfers[slot].w,
+        line,
+        display.line_buffers[line & 1]);
+}
+
+#if DISPLAY_PIO_BUS
+
+// the same entries send_header() writes, as bytes in the order they go out
+static uint8_t* put_header(uint8_t* target, const uint8_t command, const uint32_t size) {
+    *target++ = command;
+    *target++ = 0;
+    *target++ = (size * 8) >> 24;
+    *target++ = (size * 8) >> 16;
+    *target++ = (size * 8) >> 8;
+    *target++ = size * 8;
+
+    return target;
+}
+
+static uint8_t* put_range(uint8_t* target, const uint16_t start, const uint16_t end) {
+    *target++ = start >> 8;
+    *target++ = start;
+    *target++ = end >> 8;
+    *target++ = end;
+
+    return target;
+}
 
-    send(SET_PAGE_ADDRESS);
-    write16(sy0);
-    write16(sy1);
+static inline bool is_chainable(const uint32_t slot) {
+    return display.transfers[slot].line_function == NULL;
 }
 
+static inline uint16_t get_block_count(const uint32_t slot) {
+    return 1 + ((display.transfers[slot].stride == display.transfers[slot].w) ? 1 : display.transfers[slot].h);
+}
+
+// Chains the queued windows from the next one on, as many as are chainable in a row and fit in the blocks.
+static void __not_in_flash_func(start_chain)(void) {
+    uint32_t slot;
+    uint16_t block = 0;
+
+    display.chain.window_count = 0;
+
+    while ((display.completed + display.chain.window_count != display.queued) &&
+           is_chainable(slot = (display.completed + display.chain.window_count) % TRANSFER_QUEUE_CAPACITY) &&
+           (block + get_block_count(slot) <= CHAIN_BLOCK_CAPACITY)) {
+        display.chain.blocks[block].count        = PREFIX_SIZE / 2;
+        display.chain.blocks[block].read_address = (uintptr_t) display.transfers[slot].prefix;
+        block++;
+
+        if (display.transfers[slot].stride == display.transfers[slot].w) {
+            display.chain.blocks[block].count        = display.transfers[slot].w * display.transfers[slot].h;
+            display.chain.blocks[block].read_address = (uintptr_t) display.transfers[slot].data;
+            block++;
+        } else {
+            for (uint16_t line = 0; line < display.transfers[slot].h; line++) {
+                display.chain.blocks[block].count        = display.transfers[slot].w;
+                display.chain.blocks[block].read_address = (uintptr_t) fetch_line(slot, line);
+                block++;
+            }
+        }
+
+        display.stats.current.commands += 3;
+        display.stats.current.parameter_bytes += 8;
+        display.stats.current.windows++;
+        display.stats.current.pixel_bytes += display.transfers[slot].w * display.transfers[slot].h * 2;
+        display.chain.window_count++;
+    }
+
+    // the null block ends the chain with the interrupt of the data channel
+    display.chain.blocks[block].count        = 0;
+    display.chain.blocks[block].read_address = 0;
+
+    display.is_active      = true;
+    display.transfer_start = time_us_32();
+
+    dma_channel_set_read_addr(display.chain.control_channel, display.chain.blocks, true);
+}
+
+#endif
+
+static void __not_in_flash_func(start_transfer)(void) {
+    uint32_t slot = display.completed % TRANSFER_QUEUE_CAPACITY;
+
+#if DISPLAY_PIO_BUS
+    if (is_chainable(slot)) {
+        start_chain();
+        return;
+    }
+#endif
+
+    set_address(display.transfers[slot].x, display.transfers[slot].y,
+                display.transfers[slot].x + display.transfers[slot].w - 1,
+                display.transfers[slot].y + display.transfers[slot].h - 1);
+
+    begin_write(display.transfers[slot].w * display.transfers[slot].h * 2);
+
+    display.current_line   = 0;
+    display.is_active      = true;
+    display.transfer_start = time_us_32();
+
+    display.stats.current.pixel_bytes += display.transfers[slot].w * display.transfers[slot].h * 2;
+
+    // contiguous windows go out in a single dma transfer, the others one line at a time
+    if ((display.transfers[slot].line_function == NULL) && (display.transfers[slot].stride == display.transfers[slot].w)) {
+        display.line_count = 1;
+        display.line_size  = display.transfers[slot].w * display.transfers[slot].h * 2 / BUS_WORD_SIZE;
+
+        dma_channel_transfer_from_buffer_now(display.dma_channel, display.transfers[slot].data, display.line_size);
+        return;
+    }
+
+    display.line_count = display.transfers[slot].h;
+    display.line_size  = display.transfers[slot].w * 2 / BUS_WORD_SIZE;
+
+    dma_channel_transfer_from_buffer_now(display.dma_channel, fetch_line(slot, 0), display.line_size);
+
+    // the next line is prepared while this one is on the bus
+    if (display.line_count > 1) {
+        display.next_line = fetch_line(slot, 1);
+    }
+}
+
+static void __not_in_flash_func(finish_transfers)(const uint32_t count) {
+    display.is_active = false;
+    display.completed += count;
+    display.stats.current.busy_time += time_us_32() - display.transfer_start;
+
+    // an open list is started once it is complete
+    if ((display.completed != display.queued) && !display.is_listing) {
+        start_transfer();
+    }
+}
+
+static void __not_in_flash_func(transfer_done_handler)(void) {
+#if DISPLAY_PIO_BUS
+    if (dma_channel_get_irq0_status(display.chain.data_channel)) {
+        dma_channel_acknowledge_irq0(display.chain.data_channel);
+        finish_transfers(display.chain.window_count);
+        return;
+    }
+#endif
+
+    dma_channel_acknowledge_irq0(display.dma_channel);
+
+    if (++display.current_line < display.line_count) {
+        dma_channel_transfer_from_buffer_now(display.dma_channel, display.next_line, display.line_size);
+
+        if (display.current_line + 1 < display.line_count) {
+            display.next_line = fetch_line(display.completed % TRANSFER_QUEUE_CAPACITY, display.current_line + 1);
+        }
+
+        return;
+    }
+
+#if !DISPLAY_PIO_BUS
+    // the dma is done when the last byte enters the fifo, not when it leaves the bus (the pio switches dc in order)
+    while (spi_is_busy(spi_default)) {
+        tight_loop_contents();
+    }
+#endif
+
+    finish_transfers(1);
+}
+
+#if GPU_TEAR_SYNC
+static void __not_in_flash_func(vblank_handler)(uint gpio, uint32_t events) {
+    display.vblank_count++;
+}
+#endif
+
 uint display_init(void) {
+#if DISPLAY_PIO_BUS
+    // the panel is the only device on the bus, it stays selected
+    gpio_init(CS_PIN);
+    gpio_set_dir(CS_PIN, GPIO_OUT);
+    gpio_put(CS_PIN, 0);
+
+    display.pio_sm = pio_claim_unused_sm(pio0, true);
+    display_bus_program_init(pio0, display.pio_sm, pio_add_program(pio0, &display_bus_program), TX_PIN, SCK_PIN, DC_PIN,
+                             (float) clock_get_hz(clk_sys) / (2 * PIO_BUS_CLOCK));
+#else
     spi_init(spi_default, 32000000);
 
     gpio_set_function(RX_PIN, GPIO_FUNC_SPI);
@@ -82,6 +397,59 @@ uint display_init(void) {
     gpio_init(DC_PIN);
     gpio_set_dir(DC_PIN, GPIO_OUT);
     gpio_put(DC_PIN, 0);
+#endif
+
+    display.queued         = 0;
+    display.completed      = 0;
+    display.is_active      = false;
+    display.is_listing     = false;
+    display.dma_channel    = dma_claim_unused_channel(true);
+    display.stats.sequence = 0;
+    display.vblank_count   = 0;
+
+    dma_channel_config dma_config = dma_channel_get_default_config(display.dma_channel);
+#if DISPLAY_PIO_BUS
+    // the pixels are big endian in memory, the state machine shifts out the most significant bit first
+    channel_config_set_transfer_data_size(&dma_config, DMA_SIZE_16);
+    channel_config_set_bswap(&dma_config, true);
+    channel_config_set_dreq(&dma_config, pio_get_dreq(pio0, display.pio_sm, true));
+    dma_channel_configure(display.dma_channel, &dma_config, &pio0->txf[display.pio_sm], NULL, 0, false);
+
+    // the data channel of the chain goes back to the control channel after every block, which loads the next one
+    display.chain.data_channel    = dma_claim_unused_channel(true);
+    display.chain.control_channel = dma_claim_unused_channel(true);
+
+    channel_config_set_chain_to(&dma_config, display.chain.control_channel);
+    channel_config_set_irq_quiet(&dma_config, true);
+    dma_channel_configure(display.chain.data_channel, &dma_config, &pio0->txf[display.pio_sm], NULL, 0, false);
+
+    dma_channel_config control_config = dma_channel_get_default_config(display.chain.control_channel);
+    channel_config_set_transfer_data_size(&control_config, DMA_SIZE_32);
+    channel_config_set_read_increment(&control_config, true);
+    channel_config_set_write_increment(&control_config, true);
+    channel_config_set_ring(&control_config, true, 3);    // the two words of a block, count then trigger
+    dma_channel_configure(display.chain.control_channel, &control_config, &dma_hw->ch[display.chain.data_channel].al3_transfer_count, NULL, 2, false);
+#else
+    channel_config_set_transfer_data_size(&dma_config, DMA_SIZE_8);
+    channel_config_set_dreq(&dma_config, spi_get_dreq(spi_default, true));
+    dma_channel_configure(display.dma_channel, &dma_config, &spi_get_hw(spi_default)->dr, NULL, 0, false);
+#endif
+
+    // the interrupt is taken by the core that called display_init
+    dma_channel_set_irq0_enabled(display.dma_channel, true);
+#if DISPLAY_PIO_BUS
+    dma_channel_set_irq0_enabled(display.chain.data_channel, true);
+#endif
+    irq_set_exclusive_handler(DMA_IRQ_0, transfer_done_handler);
+    irq_set_enabled(DMA_IRQ_0, true);
+
+#if GPU_TEAR_SYNC
+    // te goes high when the panel enters the vertical blank (see TEARING_LINE_ON below), the pull keeps an unwired pin quiet
+    gpio_init(TE_PIN);
+    gpio_set_dir(TE_PIN, GPIO_IN);
+    gpio_pull_down(TE_PIN);
+    gpio_set_irq_enabled_with_callback(TE_PIN, GPIO_IRQ_EDGE_RISE, true, vblank_handler);
+#endif
 
     gpio_init(RESET_PIN);
     gpio_set_dir(RESET_PIN, GPIO_OUT);
@@ -118,23 +486,160 @@ uint display_init(void) {
 
 void display_clear(const uint16_t color) {
     uint16_t swapped_color = color << 8 | color >> 8;
+    uint32_t start;
+
+    display_wait_all();
+    start = time_us_32();
 
     set_address(0, 0, DISPLAY_WIDTH - 1, DISPLAY_HEIGHT - 1);
-    send(WRITE_MEMORY);
+    begin_write(DISPLAY_WIDTH * DISPLAY_HEIGHT * 2);
 
     for (int pixel = 0; pixel < DISPLAY_WIDTH * DISPLAY_HEIGHT; pixel++) {
         write16(swapped_color);
     }
+
+    display.stats.current.pixel_bytes += DISPLAY_WIDTH * DISPLAY_HEIGHT * 2;
+    display.stats.current.busy_time += time_us_32() - start;
 }
 
 void display_set_pixel(const uint16_t x, const uint16_t y, const uint16_t color) {
+    uint32_t start;
+
+    display_wait_all();
+    start = time_us_32();
+
     set_address(x, y, x, y);
-    send(WRITE_MEMORY);
+    begin_write(2);
     write16(color);
+
+    display.stats.current.pixel_bytes += 2;
+    display.stats.current.busy_time += time_us_32() - start;
 }
 
 void display_blit(const uint16_t x, const uint16_t y, const uint16_t w, const uint16_t h, uint16_t* data) {
+    uint32_t start;
+
+    display_wait_all();
+    start = time_us_32();
+
     set_address(x, y, x + w - 1, y + h - 1);
-    send(WRITE_MEMORY);
+    begin_write(w * h * 2);
     write(data, w * h * 2);
-}
\ No newline at end of file
+
+    display.stats.current.pixel_bytes += w * h * 2;
+    display.stats.current.busy_time += time_us_32() - start;
+}
+
+static void start_pending(void) {
+    uint32_t interrupts = save_and_disable_interrupts();
+
+    if (!display.is_active && (display.completed != display.queued)) {
+        start_transfer();
+    }
+
+    restore_interrupts(interrupts);
+}
+
+uint32_t display_blit_async(const uint16_t x, const uint16_t y, const uint16_t w, const uint16_t h, const uint16_t stride, const void* data, display_line_function* line_function) {
+    // a full queue sends what the open list has so far
+    while (display.queued - display.completed >= TRANSFER_QUEUE_CAPACITY) {
+        start_pending();
+    }
+
+    uint32_t slot = display.queued % TRANSFER_QUEUE_CAPACITY;
+
+    display.transfers[slot].x      = x;
+    display.transfers[slot].y      = y;
+    display.transfers[slot].w      = w;
+    display.transfers[slot].h      = h;
+    display.transfers[slot].stride = stride;
+    display.transfers[slot].data   = data;
+
+    display.transfers[slot].line_function = line_function;
+
+#if DISPLAY_PIO_BUS
+    uint8_t* prefix = (uint8_t*) display.transfers[slot].prefix;
+
+    prefix = put_header(prefix, SET_COLUMN_ADDRESS, 4);
+    prefix = put_range(prefix, x, x + w - 1);
+    prefix = put_header(prefix, SET_PAGE_ADDRESS, 4);
+    prefix = put_range(prefix, y, y + h - 1);
+    put_header(prefix, WRITE_MEMORY, w * h * 2);
+#endif
+
+    // the slot must be filled before the interrupt can see it
+    __dmb();
+    display.queued++;
+
+    if (!display.is_listing) {
+        start_pending();
+    }
+
+    return display.queued;
+}
+
+void display_begin_list(void) {
+    display.is_listing = true;
+}
+
+void display_end_list(void) {
+    display.is_listing = false;
+    start_pending();
+}
+
+bool display_is_done(const uint32_t ticket) {
+    return (int32_t) (display.completed - ticket) >= 0;
+}
+
+void display_wait(const uint32_t ticket) {
+    while (!display_is_done(ticket)) {
+        tight_loop_contents();
+    }
+}
+
+void display_wait_all(void) {
+    display_wait(display.queued);
+}
+
+void display_end_frame(void) {
+    uint32_t interrupts = save_and_disable_interrupts();
+
+    display.stats.sequence++;
+    __dmb();
+    display.stats.last = display.stats.current;
+    __dmb();
+    display.stats.sequence++;
+
+    display.stats.current = (display_stats) {0};
+    restore_interrupts(interrupts);
+}
+
+void display_get_frame_stats(display_stats* stats) {
+    uint32_t sequence;
+
+    // retries while the owning core is in the middle of publishing a frame
+    do {
+        sequence = display.stats.sequence;
+        __dmb();
+        *stats = display.stats.last;
+        __dmb();
+    } while ((sequence & 1) || (sequence != display.stats.sequence));
+}
+
+uint32_t display_get_vblank_count(void) {
+    return display.vblank_count;
+}
+
+bool display_wait_vblank(const uint32_t count) {
+    uint32_t start = time_us_32();
+
+    while ((int32_t) (display.vblank_count - count) < 0) {
+        if (time_us_32() - start > VBLANK_TIMEOUT) {
+            return false;
+        }
+
+        tight_loop_contents();
+    }
+
+    return true;
+}
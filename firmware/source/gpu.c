@@ -1,55 +1,195 @@
 #include "api.h"
+#include "assets.h"
+#include "hardware/sync.h"
 #include "pico/multicore.h"
 #include "pico/stdlib.h"
-#include "pico/util/queue.h"
 
 #include <stdarg.h>
-#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef GPU_INDEXED_FRAMEBUFFER
+    #define GPU_INDEXED_FRAMEBUFFER 0
+#endif
+
+#ifndef GPU_TEAR_SYNC
+    #define GPU_TEAR_SYNC 0
+#endif
+
+#ifndef GPU_DIRECT_RENDER
+    #define GPU_DIRECT_RENDER 0
+#endif
+
+#ifndef GPU_SPLIT_RASTER
+    #define GPU_SPLIT_RASTER 0
+#endif
+
+#if GPU_SPLIT_RASTER && GPU_DIRECT_RENDER
+    #error "the split raster bins the commands core1 receives, in direct render mode core0 draws them itself"
+#endif
 
 #define FRAMEBUFFER_X           (DISPLAY_WIDTH - GPU_RESOLUTION_WIDTH) * 0.5
 #define FRAMEBUFFER_Y           (DISPLAY_HEIGHT - GPU_RESOLUTION_HEIGHT) * 0.5
 #define FRAMEBUFFER_CELL_WIDTH  32
 #define FRAMEBUFFER_CELL_HEIGHT 24
-#define FRAMEBUFFER_CELL_SIZE   FRAMEBUFFER_CELL_WIDTH* FRAMEBUFFER_CELL_HEIGHT
-#define FRAMEBUFFER_COLUMNS     GPU_RESOLUTION_WIDTH / FRAMEBUFFER_CELL_WIDTH
-#define FRAMEBUFFER_ROWS        GPU_RESOLUTION_HEIGHT / FRAMEBUFFER_CELL_HEIGHT
-
-#define SMALL_FONT_COLUMNS SMALL_FONT_WIDTH / GPU_SMALL_CHAR_WIDTH
-#define SMALL_FONT_ROWS    SMALL_FONT_HEIGHT / GPU_SMALL_CHAR_HEIGHT
-
+#define FRAMEBUFFER_COLUMNS     (GPU_RESOLUTION_WIDTH / FRAMEBUFFER_CELL_WIDTH)
+#define FRAMEBUFFER_ROWS        (GPU_RESOLUTION_HEIGHT / FRAMEBUFFER_CELL_HEIGHT)
+
+// what goes out to the display
+#if GPU_DIRECT_RENDER
+    #define OUTPUT_BUFFER gpu.front
+#else
+    #define OUTPUT_BUFFER gpu.framebuffer
+#endif
+
+// Commands are packed records in a single producer (core0) single consumer (core1) ring of words. The
+// first word holds the command in bits 0-7, the record length in words in bits 8-15 and a small parameter
+// in bits 16-31, the rest of the record follows.
 #define COMMAND_CLEAR                0
 #define COMMAND_SET_BACKGROUND_COLOR 1
 #define COMMAND_SET_FOREGROUND_COLOR 2
 #define COMMAND_SET_PALETTE          3
-#define COMMAND_SET_X                4
-#define COMMAND_SET_Y                5
-#define COMMAND_SET_W                6
-#define COMMAND_SET_H                7
-#define COMMAND_SET_PIXEL            8
-#define COMMAND_BLIT                 9
-#define COMMAND_PRINT_SMALL          10
-#define COMMAND_SYNC                 11
-
-#define PRINT_BUFFER_CAPACITY   16
+#define COMMAND_SET_SCALE            4
+#define COMMAND_SET_PIXEL            5    // x | y << 16
+#define COMMAND_BLIT                 6    // x | y << 16, w | h << 16, data pointer (the parameter holds the BLIT_ flags)
+#define COMMAND_PRINT_SMALL          7    // x | y << 16, font pointer, packed characters (the parameter is the length)
+#define COMMAND_SYNC                 8    // time_us_32() of the sync
+#define COMMAND_SKIP                 9    // fills the end of the ring when a record does not fit
+#define COMMAND_CALL                 10   // display list pointer
+#define COMMAND_SET_SPRITE           11   // x | y << 16, w | h << 16, flags | palette << 8 | priority << 16, data pointer
+#define COMMAND_MOVE_SPRITE          12   // x | y << 16
+#define COMMAND_HIDE_SPRITE          13
+#define COMMAND_SET_TILEMAP          14   // columns | rows << 16, sheet pointer, map pointer
+#define COMMAND_SCROLL_TILEMAP       15   // x | y << 16
+#define COMMAND_SET_TILE             16   // column | row << 16 (the parameter is the tile)
+#define COMMAND_SET_TEXT             17   // x | y << 16, color | length << 16, font pointer, packed characters
+#define COMMAND_HIDE_TEXT            18
+#define COMMAND_PATCH_LIST           19   // x | y << 16, display list pointer (the parameter is the position)
+
+#define BLIT_OPAQUE 1
+#define BLIT_RLE    2
+
+#define POINTER_WORDS (sizeof(void*) / sizeof(uint32_t))
+
+// setting up a display window costs about as much bus time as this many pixels
+#define WINDOW_OVERHEAD_PIXELS 32
+
+// a sync this close to the frame time still starts the frame, or the jitter between two equal clocks drops it
+#define FRAME_TIME_SLACK_DIVISOR 8
+
+// Split raster: drawing commands are copied into the bin arena (after the state word they were binned with) and
+// listed in the bins of the cells they touch, then both cores rasterize whole cells, each clipped to its cell and
+// drawing with the state of the command. Running out of either flushes the bins early.
+#define BIN_ARENA_WORDS 2048
+#define BIN_CAPACITY    64
+#define CELL_COUNT      (FRAMEBUFFER_ROWS * FRAMEBUFFER_COLUMNS)
+
+// once the ring is drained core1 waits this long for more commands to bin, unless core0 is already waiting for it
+#define RASTER_IDLE_TIME 100    // microseconds
+
+// the colors and palette the drawing commands use, packed in a word
+#define STATE_BACKGROUND(state) ((state) & 0xFF)
+#define STATE_FOREGROUND(state) (((state) >> 8) & 0xFF)
+#define STATE_PALETTE(state)    ((state) >> 16)
+
+// shown around the framebuffer when it does not fill the display
+#define BORDER_COLOR 0x528A
+
+// A full frame at 1x is 160 * 120 * 2 = 38,400 bytes, about 9.8ms on the 31.25MHz SPI bus (~100 fps).
+// At 2x every pixel goes out four times: 320 * 240 * 2 = 153,600 bytes, about 39.3ms (~25 fps). Only the
+// dirty windows are sent, so both figures are worst cases.
+
 #define PRINT_BUFFER_MAX_LENGTH 64
 #define PRINT_RIGHT_START       GPU_PRINT_RIGHT - 1000
 
-#define SMALL_FONT_WIDTH  80
-#define SMALL_FONT_HEIGHT 56
+// The indexed framebuffer stores palette indices (19,200 bytes instead of 38,400) and the palette is
+// applied while a window is streamed to the display, so a palette change affects the whole screen.
+#if GPU_INDEXED_FRAMEBUFFER
+typedef uint8_t pixel;
+#else
+typedef uint16_t pixel;
+#endif
 
-extern uint16_t img_small_font[];
+typedef struct {
+        uint8_t x0, y0, x1, y1;
+} rect;
 
-static struct {
-        struct {
-                uint16_t x;
-                uint16_t y;
-        } coords;
+// Glyphs are kept in RAM as one bit mask per row, bit 0 being the leftmost pixel, so drawing text does not
+// read the font image through the flash cache one pixel at a time.
+typedef struct {
+        uint8_t char_width;
+        uint8_t char_height;
+        uint8_t glyph_count;
+        uint8_t rows[GPU_FONT_MAX_GLYPHS][GPU_FONT_MAX_CHAR_HEIGHT];
+} font;
+
+// Display lists hold command records in the same format as the ring. Core1 remembers which cells the last
+// run of a list wrote and the cell serials right after it, so an unchanged list only redraws the cells
+// that something else wrote to in the meantime.
+typedef struct {
+        uint32_t*         words;
+        uint16_t          capacity;
+        uint16_t          length;
+        uint32_t          version;
+        volatile uint32_t calls;
+        volatile uint32_t returns;
+        bool              is_overflowed;
+
+        // owned by core1
+        uint32_t drawn_version;
+        uint32_t drawn_state;
+        uint32_t cell_mask;
+        uint16_t cell_serials[FRAMEBUFFER_ROWS * FRAMEBUFFER_COLUMNS];
+} display_list;
+
+// Sprites and texts never touch the framebuffer, they are drawn over it while the dirty windows are streamed
+// to the display. Core1 updates the pending tables and they are latched at sync, so moving a sprite or
+// changing a text only resends the areas it left and entered.
+typedef struct {
+        int16_t        x;
+        int16_t        y;
+        uint16_t       w;
+        uint16_t       h;
+        const uint8_t* data;
+        uint8_t        flags;
+        uint8_t        palette;
+        uint8_t        priority;
+        bool           is_visible;
+        bool           is_changed;
+} sprite;
+
+// The tiles around the visible part of the tilemap are kept rendered in a cache that wraps around in both
+// directions, scrolling only renders the tile columns and rows that come into view.
+#define TILE_CACHE_COLUMNS ((GPU_RESOLUTION_WIDTH / GPU_TILE_WIDTH) + 1)
+#define TILE_CACHE_ROWS    ((GPU_RESOLUTION_HEIGHT / GPU_TILE_HEIGHT) + 1)
+#define TILE_CACHE_WIDTH   (TILE_CACHE_COLUMNS * GPU_TILE_WIDTH)
+#define TILE_CACHE_HEIGHT  (TILE_CACHE_ROWS * GPU_TILE_HEIGHT)
+
+// clearing to the tilemap is told apart from clearing to a color by this bit
+#define CLEAR_TILEMAP 0x80000000
 
-        struct {
-                uint16_t w;
-                uint16_t h;
-        } size;
+typedef struct {
+        const uint8_t* data;
+        uint16_t       width;
+        uint16_t       height;
+        uint16_t       columns;
+} tile_sheet;
+
+typedef struct {
+        int16_t     x;
+        int16_t     y;
+        uint16_t    color;    // a display color, or a palette index with the indexed framebuffer
+        const font* text_font;
+        char*       chars;
+        uint8_t     length;
+        bool        is_visible;
+        bool        is_changed;
+} retained_text;
+
+// the longest record, used to swallow the commands that do not fit in a display list
+#define LIST_SCRATCH_WORDS (3 + POINTER_WORDS + (PRINT_BUFFER_MAX_LENGTH / 4))
 
+static struct {
         struct {
                 uint8_t background;
                 uint8_t foreground;
@@ -60,26 +200,143 @@ static struct {
                 uint64_t last_sync;
                 uint64_t last_frame;
                 uint64_t last_busy;
+                uint64_t frame_busy;
+                uint32_t vblank_divisor;
+                uint32_t last_vblank;
+                uint32_t step_vblank;    // the one the last cpu step was due on
+                bool     has_tearing_signal;
         } time;
 
+        // the queued count is owned by core0, the rest by core1
+        struct {
+                volatile uint32_t queued;
+                volatile uint32_t synced;
+                volatile uint32_t throttled;
+                bool              is_skipping;
+                gpu_frame_stats   stats;
+        } frames;
+
+        struct {
+                uint8_t  scale;
+                uint16_t x;
+                uint16_t y;
+
+                display_line_function* line_function;
+                const uint16_t*        palette;
+                uint32_t               overlay_ticket;    // the last window drawn with sprites or texts over it
+                bool                   is_invalidated;    // every cell has to go out, whatever it holds
+                uint8_t                next_scale;        // set by core0 in direct render mode, applied at the next swap
+        } output;
+
         struct {
                 uint8_t  active_index;
                 uint16_t colors[GPU_PALETTE_COUNT][256];
         } palette;
 
         struct {
-                char     buffers[PRINT_BUFFER_CAPACITY][PRINT_BUFFER_MAX_LENGTH];
-                uint16_t buffer_length[PRINT_BUFFER_CAPACITY];
-                uint16_t buffer_index;
+                char        buffer[PRINT_BUFFER_MAX_LENGTH + 1];
+                font        fonts[GPU_MAX_FONTS];
+                uint8_t     font_count;
+                const font* current_font;
         } text;
 
+#if GPU_DIRECT_RENDER
+        // core0 draws into the back buffer (framebuffer) while core1 streams the front one
+        pixel buffers[2][GPU_RESOLUTION_HEIGHT][GPU_RESOLUTION_WIDTH];
+        pixel (*framebuffer)[GPU_RESOLUTION_WIDTH];
+        pixel (*front)[GPU_RESOLUTION_WIDTH];
+#else
+        pixel framebuffer[GPU_RESOLUTION_HEIGHT][GPU_RESOLUTION_WIDTH];
+#endif
+
         struct {
-                uint16_t data[FRAMEBUFFER_CELL_SIZE];
+                rect     dirty_area;
+                rect     drawn_area;
                 bool     is_dirty;
                 bool     is_clear;
-        } framebuffer[FRAMEBUFFER_ROWS][FRAMEBUFFER_COLUMNS];
+                uint16_t serial;
+                uint32_t flush_ticket;
+                uint32_t clear_key;    // color (or tilemap version) of the last clear
+        } cells[FRAMEBUFFER_ROWS][FRAMEBUFFER_COLUMNS];
+
+#if GPU_SPLIT_RASTER
+        // binned by core1, read by both cores while they rasterize
+        struct {
+                uint32_t words[BIN_ARENA_WORDS];
+                uint16_t used;
+                uint16_t entries[CELL_COUNT][BIN_CAPACITY];
+                uint8_t  counts[CELL_COUNT];
+        } bins;
+
+        // the cells of the bins being rasterized, handed out under the lock
+        struct {
+                spin_lock_t*     lock;
+                uint8_t          cells[CELL_COUNT];
+                volatile uint8_t next;
+                volatile uint8_t count;
+                volatile uint8_t done;
+                rect             clips[2];     // the cell each core is drawing
+                uint32_t         states[2];    // and the state of the command it is drawing
+                volatile bool    is_core0_waiting;
+        } raster;
+#endif
+
+        struct {
+                uint32_t          words[GPU_COMMAND_RING_SIZE];
+                volatile uint32_t head;
+                volatile uint32_t tail;
+                uint32_t          write;
+                uint32_t          peak_usage;
+                uint8_t           batch_depth;
+        } ring;
+
+        struct {
+                sprite   pending[GPU_MAX_SPRITES];
+                sprite   shown[GPU_MAX_SPRITES];
+                uint8_t  order[GPU_MAX_SPRITES];    // visible shown sprites, lowest priority first
+                uint8_t  count;
+        } sprites;
+
+        struct {
+                retained_text pending[GPU_MAX_TEXTS];
+                retained_text shown[GPU_MAX_TEXTS];
+
+                // what core0 last sent for each text, so unchanged ones cost nothing
+                retained_text sent[GPU_MAX_TEXTS];
+                uint8_t       capacities[GPU_MAX_TEXTS];
+                uint8_t       count;
+                char          arena[GPU_TEXT_ARENA_SIZE];
+                uint16_t      arena_used;
+        } texts;
 
-        queue_t commands;
+        struct {
+                tile_sheet table[GPU_MAX_SHEETS];
+                uint8_t    count;
+        } sheets;
+
+        struct {
+                const tile_sheet* sheet;
+                uint8_t*          map;
+                uint16_t          columns;
+                uint16_t          rows;
+                uint16_t          scroll_x;
+                uint16_t          scroll_y;
+                uint32_t          version;
+
+                // the scroll the cache was last brought up to date with
+                uint16_t cache_x;
+                uint16_t cache_y;
+                uint8_t  cache_palette;
+                bool     is_cache_valid;
+                pixel    cache[TILE_CACHE_HEIGHT][TILE_CACHE_WIDTH];
+        } tilemap;
+
+        struct {
+                display_list  table[GPU_MAX_LISTS];
+                uint8_t       count;
+                display_list* recording;
+                uint32_t      scratch[LIST_SCRATCH_WORDS];
+        } lists;
 } gpu;
 
 typedef struct {
@@ -368,283 +625,2369 @@ static void build_palettes() {
                         2);
 }
 
-static inline void push_command(const int command, const int param) {
-    queue_add_blocking(&gpu.commands, &command);
-    queue_add_blocking(&gpu.commands, &param);
+static inline uint16_t rect_area(const rect area) {
+    return (area.x1 - area.x0 + 1) * (area.y1 - area.y0 + 1);
 }
 
-void gpu_clear() {
-    push_command(COMMAND_CLEAR, 0);
+static inline rect rect_union(const rect a, const rect b) {
+    return (rect) {MIN(a.x0, b.x0), MIN(a.y0, b.y0), MAX(a.x1, b.x1), MAX(a.y1, b.y1)};
 }
 
-void gpu_set_background_color(const uint8_t color) {
-    push_command(COMMAND_SET_BACKGROUND_COLOR, color);
+static void begin_area_write(const rect area) {
+    rect cell_area;
+
+    for (int row = area.y0 / FRAMEBUFFER_CELL_HEIGHT; row <= area.y1 / FRAMEBUFFER_CELL_HEIGHT; row++) {
+        for (int column = area.x0 / FRAMEBUFFER_CELL_WIDTH; column <= area.x1 / FRAMEBUFFER_CELL_WIDTH; column++) {
+#if !GPU_DIRECT_RENDER
+            // the cell may still be streaming to the display from the last sync
+            display_wait(gpu.cells[row][column].flush_ticket);
+#endif
+
+            cell_area.x0 = MAX(area.x0, column * FRAMEBUFFER_CELL_WIDTH);
+            cell_area.y0 = MAX(area.y0, row * FRAMEBUFFER_CELL_HEIGHT);
+            cell_area.x1 = MIN(area.x1, ((column + 1) * FRAMEBUFFER_CELL_WIDTH) - 1);
+            cell_area.y1 = MIN(area.y1, ((row + 1) * FRAMEBUFFER_CELL_HEIGHT) - 1);
+
+            gpu.cells[row][column].dirty_area = gpu.cells[row][column].is_dirty ? rect_union(gpu.cells[row][column].dirty_area, cell_area) : cell_area;
+            gpu.cells[row][column].drawn_area = gpu.cells[row][column].is_clear ? cell_area : rect_union(gpu.cells[row][column].drawn_area, cell_area);
+            gpu.cells[row][column].is_dirty   = true;
+            gpu.cells[row][column].is_clear   = false;
+            gpu.cells[row][column].serial++;
+        }
+    }
 }
 
-void gpu_set_palette(const uint8_t palette_index) {
-    push_command(COMMAND_SET_PALETTE, palette_index);
+static void mark_area_dirty(const rect area) {
+    rect cell_area;
+
+    for (int row = area.y0 / FRAMEBUFFER_CELL_HEIGHT; row <= area.y1 / FRAMEBUFFER_CELL_HEIGHT; row++) {
+        for (int column = area.x0 / FRAMEBUFFER_CELL_WIDTH; column <= area.x1 / FRAMEBUFFER_CELL_WIDTH; column++) {
+            cell_area.x0 = MAX(area.x0, column * FRAMEBUFFER_CELL_WIDTH);
+            cell_area.y0 = MAX(area.y0, row * FRAMEBUFFER_CELL_HEIGHT);
+            cell_area.x1 = MIN(area.x1, ((column + 1) * FRAMEBUFFER_CELL_WIDTH) - 1);
+            cell_area.y1 = MIN(area.y1, ((row + 1) * FRAMEBUFFER_CELL_HEIGHT) - 1);
+
+            gpu.cells[row][column].dirty_area = gpu.cells[row][column].is_dirty ? rect_union(gpu.cells[row][column].dirty_area, cell_area) : cell_area;
+            gpu.cells[row][column].is_dirty   = true;
+        }
+    }
 }
 
-void gpu_set_pixel(const uint16_t x, const uint16_t y, uint8_t color) {
-    push_command(COMMAND_SET_X, x);
-    push_command(COMMAND_SET_Y, y);
-    push_command(COMMAND_SET_PIXEL, color);
+static void invalidate_cells(void) {
+    for (int row = 0; row < FRAMEBUFFER_ROWS; row++) {
+        for (int column = 0; column < FRAMEBUFFER_COLUMNS; column++) {
+            gpu.cells[row][column].dirty_area = (rect) {
+                column * FRAMEBUFFER_CELL_WIDTH,
+                row * FRAMEBUFFER_CELL_HEIGHT,
+                ((column + 1) * FRAMEBUFFER_CELL_WIDTH) - 1,
+                ((row + 1) * FRAMEBUFFER_CELL_HEIGHT) - 1,
+            };
+
+            gpu.cells[row][column].is_dirty = true;
+        }
+    }
+
+    gpu.output.is_invalidated = true;
 }
 
-void gpu_blit(const uint16_t x, const uint16_t y, const uint16_t w, const uint16_t h, uint8_t* data) {
-    push_command(COMMAND_SET_X, x);
-    push_command(COMMAND_SET_Y, y);
-    push_command(COMMAND_SET_W, w);
-    push_command(COMMAND_SET_H, h);
-    push_command(COMMAND_BLIT, (intptr_t) data);
+static inline bool should_merge(const rect a, const rect b) {
+    // scaled pixels cost more bus time, so the window overhead is worth fewer of them
+    return rect_area(rect_union(a, b)) <= rect_area(a) + rect_area(b) + (WINDOW_OVERHEAD_PIXELS / (gpu.output.scale * gpu.output.scale));
 }
 
-void gpu_print_small(const uint16_t x, const uint16_t y, const char* text, ...) {
-    if (gpu.text.buffer_index >= PRINT_BUFFER_CAPACITY) {
-        return;
+// Returns false when nothing of the rectangle is on screen.
+static inline bool clip_area(const int16_t x, const int16_t y, const uint16_t w, const uint16_t h, rect* area) {
+    if ((w == 0) || (h == 0) || (x >= GPU_RESOLUTION_WIDTH) || (y >= GPU_RESOLUTION_HEIGHT) || (x + w <= 0) || (y + h <= 0)) {
+        return false;
     }
 
-    uint16_t print_index = gpu.text.buffer_index++;
+    *area = (rect) {MAX(x, 0), MAX(y, 0), MIN(x + w - 1, GPU_RESOLUTION_WIDTH - 1), MIN(y + h - 1, GPU_RESOLUTION_HEIGHT - 1)};
 
-    va_list list;
-    va_start(list, text);
-    gpu.text.buffer_length[print_index] = vsprintf(gpu.text.buffers[print_index], text, list);
-    va_end(list);
+    return true;
+}
 
-    if (x < PRINT_RIGHT_START) {
-        push_command(COMMAND_SET_X, x);
-    } else {
-        push_command(COMMAND_SET_X, GPU_RESOLUTION_WIDTH - (gpu.text.buffer_length[print_index] * (GPU_SMALL_CHAR_WIDTH + 1)) - (GPU_PRINT_RIGHT - x));
+static inline rect get_raster_clip(void) {
+#if GPU_SPLIT_RASTER
+    return gpu.raster.clips[get_core_num()];
+#else
+    return (rect) {0, 0, GPU_RESOLUTION_WIDTH - 1, GPU_RESOLUTION_HEIGHT - 1};
+#endif
+}
+
+// clip_area() restricted to what the calling core is drawing
+static inline bool clip_raster_area(const int16_t x, const int16_t y, const uint16_t w, const uint16_t h, rect* area) {
+    const rect clip = get_raster_clip();
+
+    if (!clip_area(x, y, w, h, area) || (area->x0 > clip.x1) || (area->y0 > clip.y1) || (area->x1 < clip.x0) || (area->y1 < clip.y0)) {
+        return false;
     }
 
-    push_command(COMMAND_SET_Y, y);
-    push_command(COMMAND_PRINT_SMALL, print_index);
+    *area = (rect) {MAX(area->x0, clip.x0), MAX(area->y0, clip.y0), MIN(area->x1, clip.x1), MIN(area->y1, clip.y1)};
+
+    return true;
 }
 
-void gpu_sync() {
-    push_command(COMMAND_SYNC, 0);
+static inline uint32_t get_state(void) {
+    return gpu.colors.background | (gpu.colors.foreground << 8) | (gpu.palette.active_index << 16);
 }
 
-void gpu_set_foreground_color(const uint8_t color) {
-    push_command(COMMAND_SET_FOREGROUND_COLOR, color);
+// get_state() of the command the calling core is drawing
+static inline uint32_t get_draw_state(void) {
+#if GPU_SPLIT_RASTER
+    return gpu.raster.states[get_core_num()];
+#else
+    return get_state();
+#endif
 }
 
-uint64_t gpu_get_last_frame_time(void) {
-    return gpu.time.last_frame;
+static inline pixel to_pixel(const uint8_t color_index, const uint8_t palette_index) {
+#if GPU_INDEXED_FRAMEBUFFER
+    return color_index;
+#else
+    return gpu.palette.colors[palette_index][color_index];
+#endif
 }
 
-uint64_t gpu_get_last_busy_time(void) {
-    return gpu.time.last_busy;
+static void __not_in_flash_func(copy_span)(pixel* target, const uint8_t* source, const uint16_t count, const uint8_t palette_index) {
+#if GPU_INDEXED_FRAMEBUFFER
+    memcpy(target, source, count);
+#else
+    const uint16_t* palette = gpu.palette.colors[palette_index];
+
+    for (uint16_t x = 0; x < count; x++) {
+        target[x] = palette[source[x]];
+    }
+#endif
 }
 
-void gpu_core() {
-    int      command, parameter, row, column, pixel_index, cell_x, cell_y;
-    uint64_t command_start, frame_start, frame_end, frame_busy_time = 0;
-    uint8_t* data;
-    uint16_t font_x, font_y, pixel_x, pixel_y, blit_x, blit_y;
-    uint8_t  current_char, last_clear_color = 0;
+// color index 0 is transparent
+static void __not_in_flash_func(copy_keyed_span)(pixel* target, const uint8_t* source, const uint16_t count, const uint8_t palette_index) {
+    for (uint16_t x = 0; x < count; x++) {
+        if (source[x] != 0) {
+            target[x] = to_pixel(source[x], palette_index);
+        }
+    }
+}
 
-    for (;;) {
-        queue_remove_blocking(&gpu.commands, &command);
-        queue_remove_blocking(&gpu.commands, &parameter);
+// Returns the start of the row count rows below the one source starts.
+static const uint8_t* skip_rle_rows(const uint8_t* source, const uint16_t w, const uint16_t count) {
+    uint16_t run_length;
 
-        command_start = time_us_64();
+    for (uint16_t row = 0; row < count; row++) {
+        for (uint16_t column = 0; column < w; column += run_length) {
+            run_length = (*source & ~GPU_RLE_OPAQUE_RUN) + 1;
+            source += (*source & GPU_RLE_OPAQUE_RUN) ? 1 + run_length : 1;
+        }
+    }
 
-        switch (command) {
-            case COMMAND_CLEAR:
-                for (row = 0; row < FRAMEBUFFER_ROWS; row++) {
-                    for (column = 0; column < FRAMEBUFFER_COLUMNS; column++) {
-                        if (gpu.framebuffer[row][column].is_clear && (last_clear_color == gpu.colors.background)) {
-                            continue;
-                        }
+    return source;
+}
 
-                        for (pixel_index = 0; pixel_index < FRAMEBUFFER_CELL_SIZE; pixel_index++) {
-                            gpu.framebuffer[row][column].data[pixel_index] = gpu.palette.colors[gpu.palette.active_index][gpu.colors.background];
-                        }
+// Skips the transparent runs and copies the visible part of the opaque ones, returns the start of the next row.
+static const uint8_t* copy_rle_row(pixel* target, const uint8_t* source, const int16_t x, const uint16_t w, const rect area, const uint8_t palette_index) {
+    int16_t  run_x = x, start, end;
+    uint16_t run_length;
 
-                        gpu.framebuffer[row][column].is_clear = true;
-                        gpu.framebuffer[row][column].is_dirty = true;
-                    }
-                }
+    for (uint16_t column = 0; column < w; column += run_length) {
+        run_length = (*source & ~GPU_RLE_OPAQUE_RUN) + 1;
 
-                last_clear_color = gpu.colors.background;
-                break;
+        if ((*source++ & GPU_RLE_OPAQUE_RUN) == 0) {
+            run_x += run_length;
+            continue;
+        }
 
-            case COMMAND_SET_BACKGROUND_COLOR:
-                gpu.colors.background = parameter;
-                break;
+        start = MAX(run_x, area.x0);
+        end   = MIN(run_x + run_length - 1, area.x1);
 
-            case COMMAND_SET_FOREGROUND_COLOR:
-                gpu.colors.foreground = parameter;
-                break;
+        if (start <= end) {
+            copy_span(&target[start], source + (start - run_x), end - start + 1, palette_index);
+        }
 
-            case COMMAND_SET_PALETTE:
-                if (parameter < GPU_PALETTE_COUNT) {
-                    gpu.palette.active_index = (uint8_t) parameter;
-                }
+        source += run_length;
+        run_x += run_length;
+    }
 
-                break;
+    return source;
+}
 
-            case COMMAND_SET_X:
-                gpu.coords.x = parameter;
-                break;
+static void blit_rle(const int16_t x, const int16_t y, const uint16_t w, const uint16_t h, const uint8_t* data, const uint8_t palette_index) {
+    rect area;
 
-            case COMMAND_SET_Y:
-                gpu.coords.y = parameter;
-                break;
+    if (!clip_raster_area(x, y, w, h, &area)) {
+        return;
+    }
 
-            case COMMAND_SET_W:
-                gpu.size.w = parameter;
-                break;
+    begin_area_write(area);
 
-            case COMMAND_SET_H:
-                gpu.size.h = parameter;
-                break;
+    // rows have different lengths, so the ones above the clipped area still have to be walked
+    data = skip_rle_rows(data, w, area.y0 - y);
 
-            case COMMAND_SET_PIXEL:
-                if ((gpu.coords.x < GPU_RESOLUTION_WIDTH) && (gpu.coords.y < GPU_RESOLUTION_HEIGHT)) {
-                    row    = gpu.coords.y / FRAMEBUFFER_CELL_HEIGHT;
-                    column = gpu.coords.x / FRAMEBUFFER_CELL_WIDTH;
-                    cell_y = gpu.coords.y % FRAMEBUFFER_CELL_HEIGHT;
-                    cell_x = gpu.coords.x % FRAMEBUFFER_CELL_WIDTH;
+    for (int16_t row = area.y0; row <= area.y1; row++) {
+        data = copy_rle_row(gpu.framebuffer[row], data, x, w, area, palette_index);
+    }
+}
 
-                    gpu.framebuffer[row][column].data[(cell_y * FRAMEBUFFER_CELL_WIDTH) + cell_x] =
-                        gpu.palette.colors[gpu.palette.active_index][(uint8_t) parameter];
+static void blit(const int16_t x, const int16_t y, const uint16_t w, const uint16_t h, const uint8_t* data, const bool is_opaque, const uint8_t palette_index) {
+    rect           area;
+    uint16_t       span_width;
+    const uint8_t* source;
 
-                    gpu.framebuffer[row][column].is_dirty = true;
-                    gpu.framebuffer[row][column].is_clear = false;
-                }
+    // clipped once, the rows are then copied as spans
+    if (!clip_raster_area(x, y, w, h, &area)) {
+        return;
+    }
 
-                break;
+    begin_area_write(area);
 
-            case COMMAND_BLIT:
-                data = (uint8_t*) parameter;
+    span_width = area.x1 - area.x0 + 1;
+    source     = data + ((area.y0 - y) * w) + (area.x0 - x);
 
-                for (uint16_t blit_y = 0; blit_y < gpu.size.h && blit_y + gpu.coords.y < GPU_RESOLUTION_HEIGHT; blit_y++) {
-                    for (uint16_t blit_x = 0; blit_x < gpu.size.w && blit_x + gpu.coords.x < GPU_RESOLUTION_WIDTH; blit_x++) {
-                        if (data[(blit_y * gpu.size.w) + blit_x] != 0) {
-                            row    = (gpu.coords.y + blit_y) / FRAMEBUFFER_CELL_HEIGHT;
-                            column = (gpu.coords.x + blit_x) / FRAMEBUFFER_CELL_WIDTH;
-                            cell_y = (gpu.coords.y + blit_y) % FRAMEBUFFER_CELL_HEIGHT;
-                            cell_x = (gpu.coords.x + blit_x) % FRAMEBUFFER_CELL_WIDTH;
+    for (uint16_t row = area.y0; row <= area.y1; row++) {
+        if (is_opaque) {
+            copy_span(&gpu.framebuffer[row][area.x0], source, span_width, palette_index);
+        } else {
+            copy_keyed_span(&gpu.framebuffer[row][area.x0], source, span_width, palette_index);
+        }
 
-                            gpu.framebuffer[row][column].data[(cell_y * FRAMEBUFFER_CELL_WIDTH) + (cell_x)] =
-                                gpu.palette.colors[gpu.palette.active_index][data[(blit_y * gpu.size.w) + blit_x]];
+        source += w;
+    }
+}
 
-                            gpu.framebuffer[row][column].is_dirty = true;
-                            gpu.framebuffer[row][column].is_clear = false;
-                        }
-                    }
-                }
+#if GPU_INDEXED_FRAMEBUFFER
 
-                break;
+static const uint16_t* __not_in_flash_func(palette_line)(const void* data, const uint16_t stride, const uint16_t w, const uint16_t line, uint16_t* buffer) {
+    const uint8_t*  source  = (const uint8_t*) data + (line * stride);
+    const uint16_t* palette = gpu.output.palette;
 
-            case COMMAND_PRINT_SMALL:
-                for (uint8_t char_index = 0; char_index < gpu.text.buffer_length[parameter]; char_index++) {
-                    current_char = gpu.text.buffers[parameter][char_index];
+    for (uint16_t x = 0; x < w; x++) {
+        buffer[x] = palette[source[x]];
+    }
 
-                    if (current_char > 127) {
-                        continue;
-                    }
+    return buffer;
+}
 
-                    font_y = (current_char / (SMALL_FONT_COLUMNS)) * GPU_SMALL_CHAR_HEIGHT;
-                    blit_y = gpu.coords.y;
+static const uint16_t* __not_in_flash_func(palette_line_2x)(const void* data, const uint16_t stride, const uint16_t w, const uint16_t line, uint16_t* buffer) {
+    const uint8_t*  source  = (const uint8_t*) data + ((line >> 1) * stride);
+    const uint16_t* palette = gpu.output.palette;
+    uint32_t*       pixels  = (uint32_t*) buffer;
+    uint32_t        color;
 
-                    for (uint8_t pixel_y = 0; pixel_y < GPU_SMALL_CHAR_HEIGHT && blit_y < GPU_RESOLUTION_HEIGHT; pixel_y++) {
-                        font_x = (current_char % (SMALL_FONT_COLUMNS)) * GPU_SMALL_CHAR_WIDTH;
-                        blit_x = gpu.coords.x + (char_index * (GPU_SMALL_CHAR_WIDTH + 1));
+    for (uint16_t x = 0; x < (w >> 1); x++) {
+        color     = palette[source[x]];
+        pixels[x] = color | (color << 16);
+    }
 
-                        for (uint8_t pixel_x = 0; pixel_x < GPU_SMALL_CHAR_WIDTH && blit_x < GPU_RESOLUTION_WIDTH; pixel_x++) {
-                            if (img_small_font[(font_y * SMALL_FONT_WIDTH) + font_x] != 0) {
-                                row    = blit_y / FRAMEBUFFER_CELL_HEIGHT;
-                                column = blit_x / FRAMEBUFFER_CELL_WIDTH;
-                                cell_y = blit_y % FRAMEBUFFER_CELL_HEIGHT;
-                                cell_x = blit_x % FRAMEBUFFER_CELL_WIDTH;
+    return buffer;
+}
 
-                                gpu.framebuffer[row][column].data[(cell_y * FRAMEBUFFER_CELL_WIDTH) + cell_x] = gpu.palette.colors[gpu.palette.active_index][gpu.colors.foreground];
+#else
 
-                                gpu.framebuffer[row][column].is_dirty = true;
-                                gpu.framebuffer[row][column].is_clear = false;
-                            }
+static const uint16_t* __not_in_flash_func(scale_line_2x)(const void* data, const uint16_t stride, const uint16_t w, const uint16_t line, uint16_t* buffer) {
+    const uint16_t* source = (const uint16_t*) data + ((line >> 1) * stride);
+    uint32_t*       pixels = (uint32_t*) buffer;
 
-                            font_x++;
-                            blit_x++;
-                        }
+    for (uint16_t x = 0; x < (w >> 1); x++) {
+        pixels[x] = source[x] | ((uint32_t) source[x] << 16);
+    }
 
-                        font_y++;
-                        blit_y++;
-                    }
-                }
+    return buffer;
+}
 
-                break;
+#endif
 
-            case COMMAND_SYNC:
-                frame_start = time_us_64();
+static void set_output_scale(const uint8_t scale) {
+    gpu.output.scale = scale;
 
-                if (gpu.time.last_sync == 0) {
-                    gpu.time.last_sync = frame_start - gpu.time.min_frame;
-                }
+    if (scale == GPU_SCALE_1X) {
+        gpu.output.x = FRAMEBUFFER_X;
+        gpu.output.y = FRAMEBUFFER_Y;
+    } else {
+        gpu.output.x = (DISPLAY_WIDTH - (GPU_RESOLUTION_WIDTH * 2)) / 2;
+        gpu.output.y = (DISPLAY_HEIGHT - (GPU_RESOLUTION_HEIGHT * 2)) / 2;
+    }
 
-                if (frame_start - gpu.time.last_sync < gpu.time.min_frame) {
-                    break;
-                }
+#if GPU_INDEXED_FRAMEBUFFER
+    gpu.output.line_function = scale == GPU_SCALE_2X ? palette_line_2x : palette_line;
+#else
+    gpu.output.line_function = scale == GPU_SCALE_2X ? scale_line_2x : NULL;
+#endif
+}
 
-                for (row = 0; row < FRAMEBUFFER_ROWS; row++) {
-                    for (column = 0; column < FRAMEBUFFER_COLUMNS; column++) {
-                        if (!gpu.framebuffer[row][column].is_dirty) {
-                            continue;
-                        }
+// Returns false when the sprite is entirely off screen.
+static bool get_sprite_area(const sprite* current, rect* area) {
+    return current->is_visible && clip_area(current->x, current->y, current->w, current->h, area);
+}
+
+static bool get_text_area(const retained_text* current, rect* area) {
+    return current->is_visible && (current->length > 0) &&
+           clip_area(current->x, current->y, (current->length * (current->text_font->char_width + 1)) - 1, current->text_font->char_height, area);
+}
 
-                        display_blit(
-                            FRAMEBUFFER_X + (column * FRAMEBUFFER_CELL_WIDTH),
-                            FRAMEBUFFER_Y + (row * FRAMEBUFFER_CELL_HEIGHT),
-                            FRAMEBUFFER_CELL_WIDTH, FRAMEBUFFER_CELL_HEIGHT,
-                            gpu.framebuffer[row][column].data);
+static void __not_in_flash_func(draw_text_line)(uint16_t* buffer, const retained_text* current, const int16_t x0, const int16_t x1, const int16_t y) {
+    const int16_t advance = current->text_font->char_width + 1;
+    int16_t       glyph_x;
+    uint16_t      color;
+    uint8_t       glyph, mask;
 
-                        gpu.framebuffer[row][column].is_dirty = false;
-                    }
-                }
+#if GPU_INDEXED_FRAMEBUFFER
+    color = gpu.output.palette[current->color];
+#else
+    color = current->color;
+#endif
+
+    for (uint8_t char_index = 0; char_index < current->length; char_index++) {
+        glyph   = (uint8_t) current->chars[char_index];
+        glyph_x = current->x + (char_index * advance);
+
+        if ((glyph >= current->text_font->glyph_count) || (glyph_x >= x1) || (glyph_x + advance <= x0)) {
+            continue;
+        }
+
+        mask = current->text_font->rows[glyph][y - current->y];
+
+        for (int16_t x = glyph_x; mask != 0; mask >>= 1, x++) {
+            if (!(mask & 1) || (x < x0) || (x >= x1)) {
+                continue;
+            }
+
+            if (gpu.output.scale == GPU_SCALE_2X) {
+                buffer[(x - x0) * 2]       = color;
+                buffer[((x - x0) * 2) + 1] = color;
+            } else {
+                buffer[x - x0] = color;
+            }
+        }
+    }
+}
+
+static const uint16_t* __not_in_flash_func(overlay_line)(const void* data, const uint16_t stride, const uint16_t w, const uint16_t line, uint16_t* buffer) {
+    const uint32_t       offset = (const pixel*) data - &OUTPUT_BUFFER[0][0];
+    const int16_t        x0 = offset % GPU_RESOLUTION_WIDTH, x1 = x0 + (w / gpu.output.scale);
+    const int16_t        y  = (offset / GPU_RESOLUTION_WIDTH) + (line / gpu.output.scale);
+    const uint16_t*      source;
+    const uint16_t*      palette;
+    const uint8_t*       row_data;
+    const sprite*        current;
+    const retained_text* text;
+    int16_t              start, end, sprite_x, sprite_y;
+    uint8_t              color_index;
+
+    // the framebuffer first, then the sprites and the texts over it
+    source = (gpu.output.line_function != NULL) ? gpu.output.line_function(data, stride, w, line, buffer) : (const uint16_t*) data + (line * stride);
+
+    if (source != buffer) {
+        memcpy(buffer, source, w * sizeof(uint16_t));
+    }
+
+    for (uint8_t order = 0; order < gpu.sprites.count; order++) {
+        current = &gpu.sprites.shown[gpu.sprites.order[order]];
+
+        if ((y < current->y) || (y >= current->y + current->h) || (current->x >= x1) || (current->x + current->w <= x0)) {
+            continue;
+        }
+
+        sprite_y = (current->flags & GPU_SPRITE_FLIP_Y) ? current->h - 1 - (y - current->y) : y - current->y;
+        row_data = current->data + (sprite_y * current->w);
+        palette  = gpu.palette.colors[current->palette];
+        start    = MAX(current->x, x0);
+        end      = MIN(current->x + current->w, x1);
+
+        for (int16_t x = start; x < end; x++) {
+            sprite_x    = (current->flags & GPU_SPRITE_FLIP_X) ? current->w - 1 - (x - current->x) : x - current->x;
+            color_index = row_data[sprite_x];
+
+            if (color_index == 0) {
+                continue;
+            }
+
+            if (gpu.output.scale == GPU_SCALE_2X) {
+                buffer[(x - x0) * 2]       = palette[color_index];
+                buffer[((x - x0) * 2) + 1] = palette[color_index];
+            } else {
+                buffer[x - x0] = palette[color_index];
+            }
+        }
+    }
+
+    for (uint8_t index = 0; index < gpu.texts.count; index++) {
+        text = &gpu.texts.shown[index];
+
+        if (text->is_visible && (y >= text->y) && (y < text->y + text->text_font->char_height)) {
+            draw_text_line(buffer, text, x0, x1, y);
+        }
+    }
+
+    return buffer;
+}
+
+static void latch_sprites(void) {
+    bool    is_changed = false;
+    rect    area;
+    uint8_t order, other;
+
+    for (uint8_t index = 0; index < GPU_MAX_SPRITES; index++) {
+        if (!gpu.sprites.pending[index].is_changed) {
+            continue;
+        }
+
+        // what the sprite left and what it entered
+        if (get_sprite_area(&gpu.sprites.shown[index], &area)) {
+            mark_area_dirty(area);
+        }
+
+        if (get_sprite_area(&gpu.sprites.pending[index], &area)) {
+            mark_area_dirty(area);
+        }
+
+        is_changed = true;
+    }
+
+    if (!is_changed) {
+        return;
+    }
+
+    // the windows of the last sync may still be reading the shown table
+    display_wait(gpu.output.overlay_ticket);
+
+    gpu.sprites.count = 0;
+
+    for (uint8_t index = 0; index < GPU_MAX_SPRITES; index++) {
+        gpu.sprites.pending[index].is_changed = false;
+        gpu.sprites.shown[index]              = gpu.sprites.pending[index];
 
-                frame_end             = time_us_64();
-                gpu.time.last_frame   = frame_end - gpu.time.last_sync;
-                gpu.time.last_busy    = frame_busy_time + (frame_end - frame_start);
-                gpu.time.last_sync    = frame_start;
-                frame_busy_time       = 0;
-                gpu.text.buffer_index = 0;
+        if (!get_sprite_area(&gpu.sprites.shown[index], &area)) {
+            continue;
+        }
+
+        // insertion keeps the table order between sprites of the same priority
+        for (order = gpu.sprites.count; order > 0; order--) {
+            other = gpu.sprites.order[order - 1];
 
+            if (gpu.sprites.shown[other].priority <= gpu.sprites.shown[index].priority) {
                 break;
+            }
+
+            gpu.sprites.order[order] = other;
+        }
+
+        gpu.sprites.order[order] = index;
+        gpu.sprites.count++;
+    }
+}
+
+static void latch_texts(void) {
+    bool is_changed = false;
+    rect area;
+
+    for (uint8_t index = 0; index < gpu.texts.count; index++) {
+        if (!gpu.texts.pending[index].is_changed) {
+            continue;
+        }
+
+        if (get_text_area(&gpu.texts.shown[index], &area)) {
+            mark_area_dirty(area);
+        }
+
+        if (get_text_area(&gpu.texts.pending[index], &area)) {
+            mark_area_dirty(area);
+        }
+
+        is_changed = true;
+    }
+
+    if (!is_changed) {
+        return;
+    }
+
+    display_wait(gpu.output.overlay_ticket);
+
+    for (uint8_t index = 0; index < gpu.texts.count; index++) {
+        if (!gpu.texts.pending[index].is_changed) {
+            continue;
+        }
+
+        gpu.texts.pending[index].is_changed = false;
+        memcpy(gpu.texts.shown[index].chars, gpu.texts.pending[index].chars, gpu.texts.pending[index].length);
+
+        gpu.texts.shown[index].x          = gpu.texts.pending[index].x;
+        gpu.texts.shown[index].y          = gpu.texts.pending[index].y;
+        gpu.texts.shown[index].color      = gpu.texts.pending[index].color;
+        gpu.texts.shown[index].text_font  = gpu.texts.pending[index].text_font;
+        gpu.texts.shown[index].length     = gpu.texts.pending[index].length;
+        gpu.texts.shown[index].is_visible = gpu.texts.pending[index].is_visible;
+    }
+}
+
+static bool has_overlays(const rect window) {
+    rect area;
+
+    for (uint8_t order = 0; order < gpu.sprites.count; order++) {
+        if (get_sprite_area(&gpu.sprites.shown[gpu.sprites.order[order]], &area) && (area.x0 <= window.x1) && (area.x1 >= window.x0) &&
+            (area.y0 <= window.y1) && (area.y1 >= window.y0)) {
+            return true;
         }
+    }
 
-        if (command != COMMAND_SYNC) {
-            frame_busy_time += time_us_64() - command_start;
+    for (uint8_t index = 0; index < gpu.texts.count; index++) {
+        if (get_text_area(&gpu.texts.shown[index], &area) && (area.x0 <= window.x1) && (area.x1 >= window.x0) && (area.y0 <= window.y1) &&
+            (area.y1 >= window.y0)) {
+            return true;
         }
     }
+
+    return false;
+}
+
+// whether the panel scan reaches window a before window b
+static inline bool is_scanned_before(const rect a, const rect b) {
+#if DISPLAY_SCANS_RIGHT_TO_LEFT
+    return a.x1 > b.x1;
+#else
+    return a.x0 < b.x0;
+#endif
 }
 
-void gpu_init(const uint8_t max_fps) {
-    gpu.coords.x             = 0;
-    gpu.coords.y             = 0;
-    gpu.size.w               = 0;
-    gpu.size.h               = 0;
-    gpu.colors.background    = 0;
-    gpu.colors.foreground    = 255;
-    gpu.time.min_frame       = 1000000 / (uint64_t) max_fps;
-    gpu.time.last_sync       = 0;
-    gpu.time.last_frame      = gpu.time.min_frame;
-    gpu.time.last_busy       = 0;
-    gpu.palette.active_index = 0;
-    gpu.text.buffer_index    = 0;
+static void flush_cells(void) {
+    rect     windows[FRAMEBUFFER_ROWS * FRAMEBUFFER_COLUMNS];
+    bool     is_merged[FRAMEBUFFER_ROWS * FRAMEBUFFER_COLUMNS];
+    uint8_t  order[FRAMEBUFFER_ROWS * FRAMEBUFFER_COLUMNS];
+    uint8_t  window_count = 0, order_count = 0, row_start, window, other, position;
+    bool     is_run_open;
+    uint32_t ticket;
+    bool     is_overlay_window;
+
+#if GPU_INDEXED_FRAMEBUFFER
+    // the palette is applied on the way out, so a new one means resending everything
+    if (gpu.output.palette != gpu.palette.colors[gpu.palette.active_index]) {
+        gpu.output.palette = gpu.palette.colors[gpu.palette.active_index];
+        invalidate_cells();
+    }
+#endif
+
+    latch_sprites();
+    latch_texts();
 
     for (int row = 0; row < FRAMEBUFFER_ROWS; row++) {
+        row_start   = window_count;
+        is_run_open = false;
+
+        // horizontal runs of dirty cells
         for (int column = 0; column < FRAMEBUFFER_COLUMNS; column++) {
-            gpu.framebuffer[row][column].is_clear = false;
-            gpu.framebuffer[row][column].is_dirty = true;
+            if (!gpu.cells[row][column].is_dirty) {
+                is_run_open = false;
+                continue;
+            }
+
+            if (is_run_open && should_merge(windows[window_count - 1], gpu.cells[row][column].dirty_area)) {
+                windows[window_count - 1] = rect_union(windows[window_count - 1], gpu.cells[row][column].dirty_area);
+            } else {
+                windows[window_count]   = gpu.cells[row][column].dirty_area;
+                is_merged[window_count] = false;
+                window_count++;
+                is_run_open = true;
+            }
+
+            gpu.cells[row][column].is_dirty = false;
+        }
+
+        // grow the windows of the rows above downwards when that is cheaper than a new window
+        for (window = row_start; window < window_count; window++) {
+            for (other = 0; other < row_start; other++) {
+                if (!is_merged[other] && should_merge(windows[other], windows[window])) {
+                    windows[other]    = rect_union(windows[other], windows[window]);
+                    is_merged[window] = true;
+                    break;
+                }
+            }
         }
     }
 
-    build_palettes();
-    queue_init_with_spinlock(&gpu.commands, sizeof(int), 1000, 1);
-    display_init();
-    multicore_launch_core1(gpu_core);
-    gpu_clear();
+    // queued in the order the panel scans them: a flush that starts with the vertical blank stays behind the scan, and
+    // the next scan cannot catch up with it unless the flush takes longer than two refreshes
+    for (window = 0; window < window_count; window++) {
+        if (is_merged[window]) {
+            continue;
+        }
+
+        for (position = order_count; (position > 0) && is_scanned_before(windows[window], windows[order[position - 1]]); position--) {
+            order[position] = order[position - 1];
+        }
+
+        order[position] = window;
+        order_count++;
+    }
+
+    // one list for the frame, started once every window is in it
+    display_begin_list();
+
+    for (position = 0; position < order_count; position++) {
+        window            = order[position];
+        is_overlay_window = has_overlays(windows[window]);
+
+        // returns as soon as the window is queued, the dma streams it while we keep rasterizing
+        ticket = display_blit_async(
+            gpu.output.x + (windows[window].x0 * gpu.output.scale),
+            gpu.output.y + (windows[window].y0 * gpu.output.scale),
+            (windows[window].x1 - windows[window].x0 + 1) * gpu.output.scale,
+            (windows[window].y1 - windows[window].y0 + 1) * gpu.output.scale,
+            GPU_RESOLUTION_WIDTH,
+            &OUTPUT_BUFFER[windows[window].y0][windows[window].x0],
+            is_overlay_window ? overlay_line : gpu.output.line_function);
+
+        if (is_overlay_window) {
+            gpu.output.overlay_ticket = ticket;
+        }
+
+        for (int row = windows[window].y0 / FRAMEBUFFER_CELL_HEIGHT; row <= windows[window].y1 / FRAMEBUFFER_CELL_HEIGHT; row++) {
+            for (int column = windows[window].x0 / FRAMEBUFFER_CELL_WIDTH; column <= windows[window].x1 / FRAMEBUFFER_CELL_WIDTH; column++) {
+                gpu.cells[row][column].flush_ticket = ticket;
+            }
+        }
+    }
+
+    display_end_list();
+    gpu.output.is_invalidated = false;
+}
+
+static void execute_command(const uint32_t* record);
+static bool assist_raster(void);
+
+#if GPU_SPLIT_RASTER
+static void rasterize_bins(void);
+#endif
+
+static inline void publish_commands(void) {
+    if (gpu.ring.head == gpu.ring.write) {
+        return;
+    }
+
+    // the record words must be visible before the consumer can see the new head
+    __dmb();
+    gpu.ring.head = gpu.ring.write;
+    __sev();
+
+    if (gpu.ring.write - gpu.ring.tail > gpu.ring.peak_usage) {
+        gpu.ring.peak_usage = gpu.ring.write - gpu.ring.tail;
+    }
+}
+
+static inline void wait_for_ring_space(const uint32_t word_count) {
+    while (gpu.ring.write + word_count - gpu.ring.tail > GPU_COMMAND_RING_SIZE) {
+        // a batch that fills the ring has to be handed over, or we would wait on ourselves
+        publish_commands();
+
+        if (!assist_raster()) {
+            __wfe();
+        }
+    }
+}
+
+static uint32_t* begin_command(const uint8_t command, const uint16_t parameter, const uint8_t word_count) {
+    uint32_t      index;
+    display_list* list = gpu.lists.recording;
+
+    if (list != NULL) {
+        if (list->length + word_count > list->capacity) {
+            list->is_overflowed = true;
+            gpu.lists.scratch[0] = command | (word_count << 8) | (parameter << 16);
+            return gpu.lists.scratch;
+        }
+
+        list->words[list->length] = command | (word_count << 8) | (parameter << 16);
+        return &list->words[list->length];
+    }
+
+#if GPU_DIRECT_RENDER
+    // only syncs go to core1, everything else runs right away (see end_command())
+    if (command != COMMAND_SYNC) {
+        gpu.lists.scratch[0] = command | (word_count << 8) | (parameter << 16);
+        return gpu.lists.scratch;
+    }
+#endif
+
+    index = gpu.ring.write % GPU_COMMAND_RING_SIZE;
+
+    // records never wrap, the rest of the ring is skipped instead
+    if (index + word_count > GPU_COMMAND_RING_SIZE) {
+        wait_for_ring_space(GPU_COMMAND_RING_SIZE - index);
+        gpu.ring.words[index] = COMMAND_SKIP | ((GPU_COMMAND_RING_SIZE - index) << 8);
+        gpu.ring.write += GPU_COMMAND_RING_SIZE - index;
+        index = 0;
+    }
+
+    wait_for_ring_space(word_count);
+    gpu.ring.words[index] = command | (word_count << 8) | (parameter << 16);
+
+    return &gpu.ring.words[index];
+}
+
+static inline void end_command(const uint32_t* record) {
+    if (gpu.lists.recording != NULL) {
+        if (record != gpu.lists.scratch) {
+            gpu.lists.recording->length += (record[0] >> 8) & 0xFF;
+        }
+
+        return;
+    }
+
+#if GPU_DIRECT_RENDER
+    if (record == gpu.lists.scratch) {
+        execute_command(record);
+        return;
+    }
+#endif
+
+    gpu.ring.write += (record[0] >> 8) & 0xFF;
+
+    if (gpu.ring.batch_depth == 0) {
+        publish_commands();
+    }
+}
+
+static inline void write_pointer(uint32_t* words, const void* pointer) {
+    memcpy(words, &pointer, sizeof(pointer));
+}
+
+static inline void* read_pointer(const uint32_t* words) {
+    void* pointer;
+    memcpy(&pointer, words, sizeof(pointer));
+    return pointer;
+}
+
+static inline void push_command(const uint8_t command, const uint16_t parameter) {
+    end_command(begin_command(command, parameter, 1));
+}
+
+void gpu_begin_batch(void) {
+    gpu.ring.batch_depth++;
+}
+
+void gpu_end_batch(void) {
+    if ((gpu.ring.batch_depth > 0) && (--gpu.ring.batch_depth == 0)) {
+        publish_commands();
+    }
+}
+
+uint16_t gpu_get_command_ring_usage(void) {
+    return gpu.ring.write - gpu.ring.tail;
+}
+
+uint16_t gpu_get_command_ring_peak_usage(void) {
+    return gpu.ring.peak_usage;
+}
+
+static void wait_for_list_returns(display_list* list) {
+    // core1 may still be reading the records
+    while (list->returns != list->calls) {
+        __wfe();
+    }
+
+    __dmb();
+}
+
+gpu_list gpu_create_list(uint32_t* buffer, const uint16_t size) {
+    if ((buffer == NULL) || (gpu.lists.count >= GPU_MAX_LISTS)) {
+        return NULL;
+    }
+
+    display_list* list = &gpu.lists.table[gpu.lists.count++];
+
+    list->words         = buffer;
+    list->capacity      = size;
+    list->length        = 0;
+    list->version       = 1;
+    list->calls         = 0;
+    list->returns       = 0;
+    list->is_overflowed = false;
+    list->drawn_version = 0;
+
+    return list;
+}
+
+void gpu_begin_list(gpu_list list) {
+    display_list* recording = (display_list*) list;
+
+    if ((recording == NULL) || (gpu.lists.recording != NULL)) {
+        return;
+    }
+
+    wait_for_list_returns(recording);
+
+    recording->length        = 0;
+    recording->is_overflowed = false;
+    recording->version++;
+    gpu.lists.recording = recording;
+}
+
+bool gpu_end_list(void) {
+    display_list* recording = gpu.lists.recording;
+
+    if (recording == NULL) {
+        return false;
+    }
+
+    gpu.lists.recording = NULL;
+
+    // a partial list would draw a partial scene, so nothing is kept
+    if (recording->is_overflowed) {
+        recording->length = 0;
+        return false;
+    }
+
+    return true;
+}
+
+uint16_t gpu_get_list_position(void) {
+    return (gpu.lists.recording != NULL) ? gpu.lists.recording->length : 0;
+}
+
+void gpu_patch_list_position(gpu_list list, const uint16_t position, const uint16_t x, const uint16_t y) {
+    display_list* patched = (display_list*) list;
+    uint8_t       command;
+
+    // the patch is a command of its own, which a list cannot record
+    if ((patched == NULL) || (position >= patched->length) || (gpu.lists.recording != NULL)) {
+        return;
+    }
+
+    command = patched->words[position] & 0xFF;
+
+    if ((command != COMMAND_SET_PIXEL) && (command != COMMAND_BLIT) && (command != COMMAND_PRINT_SMALL) && (command != COMMAND_MOVE_SPRITE) &&
+        (command != COMMAND_SCROLL_TILEMAP) && (command != COMMAND_SET_TEXT)) {
+        return;
+    }
+
+    // core1 applies the patch between the calls queued before and after it, so core0 never waits for the list, and
+    // a list that is being re-recorded waits for the patch like for a call
+    patched->calls++;
+
+    uint32_t* record = begin_command(COMMAND_PATCH_LIST, position, 2 + POINTER_WORDS);
+
+    record[1] = x | (y << 16);
+    write_pointer(&record[2], patched);
+    end_command(record);
+}
+
+void gpu_call_list(gpu_list list) {
+    display_list* called = (display_list*) list;
+
+    // lists do not nest
+    if ((called == NULL) || (gpu.lists.recording != NULL)) {
+        return;
+    }
+
+    called->calls++;
+
+    uint32_t* record = begin_command(COMMAND_CALL, 0, 1 + POINTER_WORDS);
+
+    write_pointer(&record[1], called);
+    end_command(record);
+}
+
+void gpu_set_sprite(const uint8_t index, const int16_t x, const int16_t y, const uint16_t w, const uint16_t h, const uint8_t* data, const uint8_t flags,
+                    const uint8_t palette_index, const uint8_t priority) {
+    uint32_t* record = begin_command(COMMAND_SET_SPRITE, index, 4 + POINTER_WORDS);
+
+    record[1] = (uint16_t) x | ((uint16_t) y << 16);
+    record[2] = w | (h << 16);
+    record[3] = flags | (palette_index << 8) | (priority << 16);
+    write_pointer(&record[4], data);
+    end_command(record);
+}
+
+void gpu_move_sprite(const uint8_t index, const int16_t x, const int16_t y) {
+    uint32_t* record = begin_command(COMMAND_MOVE_SPRITE, index, 2);
+
+    record[1] = (uint16_t) x | ((uint16_t) y << 16);
+    end_command(record);
+}
+
+void gpu_hide_sprite(const uint8_t index) {
+    push_command(COMMAND_HIDE_SPRITE, index);
+}
+
+gpu_sheet gpu_create_sheet(const uint8_t* data, const uint16_t w, const uint16_t h) {
+    if ((data == NULL) || (w < GPU_TILE_WIDTH) || (h < GPU_TILE_HEIGHT) || (gpu.sheets.count >= GPU_MAX_SHEETS)) {
+        return NULL;
+    }
+
+    tile_sheet* sheet = &gpu.sheets.table[gpu.sheets.count++];
+
+    // the rows that do not fill a tile are left out, like the columns, so a tile is either all in the sheet or past its end
+    sheet->data    = data;
+    sheet->width   = w;
+    sheet->height  = h - (h % GPU_TILE_HEIGHT);
+    sheet->columns = w / GPU_TILE_WIDTH;
+
+    return sheet;
+}
+
+void gpu_set_tilemap(gpu_sheet sheet, uint8_t* map, const uint16_t columns, const uint16_t rows) {
+    uint32_t* record = begin_command(COMMAND_SET_TILEMAP, 0, 2 + (POINTER_WORDS * 2));
+
+    record[1] = columns | (rows << 16);
+    write_pointer(&record[2], sheet);
+    write_pointer(&record[2 + POINTER_WORDS], map);
+    end_command(record);
+}
+
+void gpu_scroll_tilemap(const uint16_t x, const uint16_t y) {
+    uint32_t* record = begin_command(COMMAND_SCROLL_TILEMAP, 0, 2);
+
+    record[1] = x | (y << 16);
+    end_command(record);
+}
+
+void gpu_set_tile(const uint16_t column, const uint16_t row, const uint8_t tile) {
+    uint32_t* record = begin_command(COMMAND_SET_TILE, tile, 2);
+
+    record[1] = column | (row << 16);
+    end_command(record);
+}
+
+void gpu_clear() {
+    push_command(COMMAND_CLEAR, 0);
+}
+
+void gpu_set_background_color(const uint8_t color) {
+    push_command(COMMAND_SET_BACKGROUND_COLOR, color);
+}
+
+void gpu_set_palette(const uint8_t palette_index) {
+    push_command(COMMAND_SET_PALETTE, palette_index);
+}
+
+void gpu_set_scale(const uint8_t scale) {
+    push_command(COMMAND_SET_SCALE, scale);
+}
+
+void gpu_set_pixel(const uint16_t x, const uint16_t y, uint8_t color) {
+    uint32_t* record = begin_command(COMMAND_SET_PIXEL, color, 2);
+
+    record[1] = x | (y << 16);
+    end_command(record);
+}
+
+static void push_blit(const int16_t x, const int16_t y, const uint16_t w, const uint16_t h, const uint8_t* data, const uint16_t flags) {
+    uint32_t* record = begin_command(COMMAND_BLIT, flags, 3 + POINTER_WORDS);
+
+    record[1] = (uint16_t) x | ((uint16_t) y << 16);
+    record[2] = w | (h << 16);
+    write_pointer(&record[3], data);
+    end_command(record);
+}
+
+void gpu_blit(const int16_t x, const int16_t y, const uint16_t w, const uint16_t h, const uint8_t* data) {
+    push_blit(x, y, w, h, data, 0);
+}
+
+void gpu_blit_opaque(const int16_t x, const int16_t y, const uint16_t w, const uint16_t h, const uint8_t* data) {
+    push_blit(x, y, w, h, data, BLIT_OPAQUE);
+}
+
+void gpu_blit_rle(const int16_t x, const int16_t y, const uint16_t w, const uint16_t h, const uint8_t* data) {
+    push_blit(x, y, w, h, data, BLIT_RLE);
+}
+
+static bool build_font(font* target, const uint8_t* bitmap, const uint16_t w, const uint16_t h, const uint8_t char_width, const uint8_t char_height) {
+    uint16_t columns, row_bytes, image_x, image_y;
+    uint8_t  mask;
+
+    if ((bitmap == NULL) || (char_width == 0) || (char_width > GPU_FONT_MAX_CHAR_WIDTH) || (char_height == 0) || (char_height > GPU_FONT_MAX_CHAR_HEIGHT)) {
+        return false;
+    }
+
+    columns             = w / char_width;
+    row_bytes           = (w + 7) / 8;
+    target->char_width  = char_width;
+    target->char_height = char_height;
+    target->glyph_count = MIN(columns * (h / char_height), GPU_FONT_MAX_GLYPHS);
+
+    for (uint8_t glyph = 0; glyph < target->glyph_count; glyph++) {
+        image_y = (glyph / columns) * char_height;
+
+        for (uint8_t row = 0; row < char_height; row++) {
+            image_x = (glyph % columns) * char_width;
+            mask    = 0;
+
+            for (uint8_t column = 0; column < char_width; column++) {
+                if (bitmap[((image_y + row) * row_bytes) + ((image_x + column) / 8)] & (1 << ((image_x + column) % 8))) {
+                    mask |= 1 << column;
+                }
+            }
+
+            target->rows[glyph][row] = mask;
+        }
+    }
+
+    return true;
+}
+
+gpu_font gpu_create_font(const uint8_t* bitmap, const uint16_t w, const uint16_t h, const uint8_t char_width, const uint8_t char_height) {
+    if ((gpu.text.font_count >= GPU_MAX_FONTS) || !build_font(&gpu.text.fonts[gpu.text.font_count], bitmap, w, h, char_width, char_height)) {
+        return NULL;
+    }
+
+    return &gpu.text.fonts[gpu.text.font_count++];
+}
+
+void gpu_set_font(gpu_font font) {
+    // the font travels with every print, so it does not have to go through the ring
+    gpu.text.current_font = (font != NULL) ? font : &gpu.text.fonts[0];
+}
+
+static inline void append_char(char* buffer, uint8_t* length, const uint8_t size, const char value) {
+    if (*length < size) {
+        buffer[(*length)++] = value;
+    }
+}
+
+// A small replacement for vsnprintf that understands %d, %i, %u, %x, %X, %c, %s and %%, with the '-' and '0'
+// flags and a field width. The text is not terminated, its length is returned instead.
+static uint8_t format_text(char* buffer, const uint8_t size, const char* format, va_list list) {
+    char        digits[10];
+    const char* field;
+    uint8_t     length = 0, width, field_length, base;
+    uint32_t    value;
+    bool        is_left, is_negative;
+    char        padding, conversion;
+
+    while ((*format != 0) && (length < size)) {
+        if (*format != '%') {
+            buffer[length++] = *format++;
+            continue;
+        }
+
+        format++;
+        is_left     = false;
+        is_negative = false;
+        padding     = ' ';
+        width       = 0;
+        base        = 0;
+
+        for (; (*format == '-') || (*format == '0'); format++) {
+            if (*format == '-') {
+                is_left = true;
+            } else {
+                padding = '0';
+            }
+        }
+
+        for (; (*format >= '0') && (*format <= '9'); format++) {
+            width = (width * 10) + (*format - '0');
+        }
+
+        // int and long are the same size here
+        while (*format == 'l') {
+            format++;
+        }
+
+        conversion = *format;
+
+        if (conversion == 0) {
+            break;
+        }
+
+        format++;
+
+        switch (conversion) {
+            case 'd':
+            case 'i':
+                value       = va_arg(list, int);
+                is_negative = (int32_t) value < 0;
+                value       = is_negative ? -value : value;
+                base        = 10;
+                break;
+
+            case 'u':
+                value = va_arg(list, unsigned int);
+                base  = 10;
+                break;
+
+            case 'x':
+            case 'X':
+                value = va_arg(list, unsigned int);
+                base  = 16;
+                break;
+
+            case 'c':
+                digits[0]    = (char) va_arg(list, int);
+                field        = digits;
+                field_length = 1;
+                break;
+
+            case 's':
+                field        = va_arg(list, const char*);
+                field_length = strnlen(field, size);
+                break;
+
+            default:
+                digits[0]    = conversion;
+                field        = digits;
+                field_length = 1;
+                break;
+        }
+
+        if (base != 0) {
+            field_length = 0;
+
+            do {
+                field_length++;
+                digits[sizeof(digits) - field_length] = ((conversion == 'X') ? "0123456789ABCDEF" : "0123456789abcdef")[value % base];
+                value /= base;
+            } while (value != 0);
+
+            field = &digits[sizeof(digits) - field_length];
+        }
+
+        width = (width > field_length + is_negative) ? width - field_length - is_negative : 0;
+
+        // the sign goes after space padding but before zero padding
+        if (is_negative && (padding == '0')) {
+            append_char(buffer, &length, size, '-');
+        }
+
+        for (; !is_left && (width > 0); width--) {
+            append_char(buffer, &length, size, padding);
+        }
+
+        if (is_negative && (padding != '0')) {
+            append_char(buffer, &length, size, '-');
+        }
+
+        for (uint8_t field_index = 0; field_index < field_length; field_index++) {
+            append_char(buffer, &length, size, field[field_index]);
+        }
+
+        for (; width > 0; width--) {
+            append_char(buffer, &length, size, ' ');
+        }
+    }
+
+    return length;
+}
+
+static inline uint16_t get_print_x(const uint16_t x, const uint8_t length) {
+    if (x < PRINT_RIGHT_START) {
+        return x;
+    }
+
+    return GPU_RESOLUTION_WIDTH - (length * (gpu.text.current_font->char_width + 1)) - (GPU_PRINT_RIGHT - x);
+}
+
+void gpu_print_small(const uint16_t x, const uint16_t y, const char* text, ...) {
+    uint8_t length;
+
+    va_list list;
+    va_start(list, text);
+    length = format_text(gpu.text.buffer, PRINT_BUFFER_MAX_LENGTH, text, list);
+    va_end(list);
+
+    if (length == 0) {
+        return;
+    }
+
+    // the text travels inside the record, so it is only limited by the ring size
+    uint32_t* record = begin_command(COMMAND_PRINT_SMALL, length, 2 + POINTER_WORDS + ((length + 3) / 4));
+
+    record[1] = get_print_x(x, length) | (y << 16);
+    write_pointer(&record[2], gpu.text.current_font);
+    memcpy(&record[2 + POINTER_WORDS], gpu.text.buffer, length);
+    end_command(record);
+}
+
+gpu_text gpu_create_text(const uint8_t capacity) {
+    uint8_t index = gpu.texts.count, text_capacity = MIN(capacity, PRINT_BUFFER_MAX_LENGTH);
+
+    // core0 keeps one copy of the characters, core1 a pending and a shown one
+    if ((text_capacity == 0) || (index >= GPU_MAX_TEXTS) || (gpu.texts.arena_used + (text_capacity * 3) > GPU_TEXT_ARENA_SIZE)) {
+        return NULL;
+    }
+
+    gpu.texts.sent[index].chars    = &gpu.texts.arena[gpu.texts.arena_used];
+    gpu.texts.pending[index].chars = &gpu.texts.arena[gpu.texts.arena_used + text_capacity];
+    gpu.texts.shown[index].chars   = &gpu.texts.arena[gpu.texts.arena_used + (text_capacity * 2)];
+    gpu.texts.arena_used += text_capacity * 3;
+
+    gpu.texts.sent[index].is_visible    = false;
+    gpu.texts.pending[index].is_visible = false;
+    gpu.texts.pending[index].is_changed = false;
+    gpu.texts.shown[index].is_visible   = false;
+    gpu.texts.capacities[index]         = text_capacity;
+
+    // core1 only looks at the texts below the count
+    __dmb();
+    gpu.texts.count++;
+
+    return &gpu.texts.sent[index];
+}
+
+void gpu_set_text(gpu_text text, const uint16_t x, const uint16_t y, const uint8_t color, const char* format, ...) {
+    retained_text* sent = (retained_text*) text;
+    uint8_t        index, length;
+    uint16_t       text_x;
+
+    if (sent == NULL) {
+        return;
+    }
+
+    index = sent - gpu.texts.sent;
+
+    va_list list;
+    va_start(list, format);
+    length = format_text(gpu.text.buffer, gpu.texts.capacities[index], format, list);
+    va_end(list);
+
+    text_x = get_print_x(x, length);
+
+    // an unchanged text costs nothing past this point, but a recorded list can run at any time
+    if ((gpu.lists.recording == NULL) && sent->is_visible && (sent->x == text_x) && (sent->y == y) && (sent->color == color) &&
+        (sent->text_font == gpu.text.current_font) && (sent->length == length) && (memcmp(sent->chars, gpu.text.buffer, length) == 0)) {
+        return;
+    }
+
+    uint32_t* record = begin_command(COMMAND_SET_TEXT, index, 3 + POINTER_WORDS + ((length + 3) / 4));
+
+    record[1] = text_x | (y << 16);
+    record[2] = color | (length << 16);
+    write_pointer(&record[3], gpu.text.current_font);
+    memcpy(&record[3 + POINTER_WORDS], gpu.text.buffer, length);
+    end_command(record);
+
+    sent->x          = text_x;
+    sent->y          = y;
+    sent->color      = color;
+    sent->text_font  = gpu.text.current_font;
+    sent->length     = length;
+    sent->is_visible = gpu.lists.recording == NULL;
+    memcpy(sent->chars, gpu.text.buffer, length);
+}
+
+void gpu_hide_text(gpu_text text) {
+    retained_text* sent = (retained_text*) text;
+
+    if ((sent == NULL) || (!sent->is_visible && (gpu.lists.recording == NULL))) {
+        return;
+    }
+
+    push_command(COMMAND_HIDE_TEXT, sent - gpu.texts.sent);
+    sent->is_visible = false;
+}
+
+void gpu_sync() {
+    uint32_t* record = begin_command(COMMAND_SYNC, 0, 2);
+
+    // counted before core1 can see it, syncs recorded into a list are never executed
+    if (gpu.lists.recording == NULL) {
+        gpu.frames.queued++;
+    }
+
+    record[1] = time_us_32();
+    end_command(record);
+
+#if GPU_DIRECT_RENDER
+    // core1 owns the cells and the buffers until it has taken the frame
+    if (gpu.lists.recording == NULL) {
+        publish_commands();
+
+        while (gpu.frames.synced != gpu.frames.queued) {
+            __wfe();
+        }
+
+        __dmb();
+    }
+#endif
+}
+
+void gpu_set_foreground_color(const uint8_t color) {
+    push_command(COMMAND_SET_FOREGROUND_COLOR, color);
+}
+
+uint64_t gpu_get_last_frame_time(void) {
+    return gpu.time.last_frame;
+}
+
+void gpu_wait_for_frames(void) {
+    publish_commands();
+
+    if (gpu.frames.queued - gpu.frames.synced <= GPU_MAX_QUEUED_FRAMES) {
+        return;
+    }
+
+    gpu.frames.throttled++;
+
+    while (gpu.frames.queued - gpu.frames.synced > GPU_MAX_QUEUED_FRAMES) {
+        if (!assist_raster()) {
+            __wfe();
+        }
+    }
+}
+
+void gpu_get_frame_stats(gpu_frame_stats* stats) {
+    *stats           = gpu.frames.stats;
+    stats->throttled = gpu.frames.throttled;
+}
+
+uint64_t gpu_get_last_busy_time(void) {
+    return gpu.time.last_busy;
+}
+
+static void render_tile(const uint16_t column, const uint16_t row) {
+    const tile_sheet* sheet = gpu.tilemap.sheet;
+    pixel*            cache_line;
+    const uint8_t*    sheet_line;
+    uint8_t           tile = gpu.tilemap.map[((row % gpu.tilemap.rows) * gpu.tilemap.columns) + (column % gpu.tilemap.columns)];
+    uint16_t          sheet_x = (tile % sheet->columns) * GPU_TILE_WIDTH, sheet_y = (tile / sheet->columns) * GPU_TILE_HEIGHT;
+    uint16_t          cache_x = (column % TILE_CACHE_COLUMNS) * GPU_TILE_WIDTH, cache_y = (row % TILE_CACHE_ROWS) * GPU_TILE_HEIGHT;
+
+    for (uint8_t y = 0; y < GPU_TILE_HEIGHT; y++) {
+        cache_line = &gpu.tilemap.cache[cache_y + y][cache_x];
+
+        // tiles past the end of the sheet show the background color
+        if (sheet_y >= sheet->height) {
+            for (uint8_t x = 0; x < GPU_TILE_WIDTH; x++) {
+                cache_line[x] = to_pixel(gpu.colors.background, gpu.palette.active_index);
+            }
+
+            continue;
+        }
+
+        sheet_line = &sheet->data[((sheet_y + y) * sheet->width) + sheet_x];
+
+        for (uint8_t x = 0; x < GPU_TILE_WIDTH; x++) {
+            cache_line[x] = to_pixel(sheet_line[x], gpu.palette.active_index);
+        }
+    }
+}
+
+static void render_tiles(const uint16_t column, const uint16_t row, const uint16_t columns, const uint16_t rows) {
+    for (uint16_t tile_row = row; tile_row != (uint16_t) (row + rows); tile_row++) {
+        for (uint16_t tile_column = column; tile_column != (uint16_t) (column + columns); tile_column++) {
+            render_tile(tile_column, tile_row);
+        }
+    }
+}
+
+// Brings the cache up to date with the current scroll and returns what a clear to the tilemap means now.
+static uint32_t update_tile_cache(void) {
+    uint16_t column = gpu.tilemap.scroll_x / GPU_TILE_WIDTH, row = gpu.tilemap.scroll_y / GPU_TILE_HEIGHT;
+    uint16_t cache_column = gpu.tilemap.cache_x / GPU_TILE_WIDTH, cache_row = gpu.tilemap.cache_y / GPU_TILE_HEIGHT;
+    int16_t  column_delta = column - cache_column, row_delta = row - cache_row;
+
+#if !GPU_INDEXED_FRAMEBUFFER
+    // the cache holds display colors
+    if (gpu.tilemap.cache_palette != gpu.palette.active_index) {
+        gpu.tilemap.cache_palette  = gpu.palette.active_index;
+        gpu.tilemap.is_cache_valid = false;
+    }
+#endif
+
+    if (!gpu.tilemap.is_cache_valid || (abs(column_delta) >= TILE_CACHE_COLUMNS) || (abs(row_delta) >= TILE_CACHE_ROWS)) {
+        render_tiles(column, row, TILE_CACHE_COLUMNS, TILE_CACHE_ROWS);
+        gpu.tilemap.is_cache_valid = true;
+        gpu.tilemap.version++;
+    } else {
+        if (column_delta > 0) {
+            render_tiles(cache_column + TILE_CACHE_COLUMNS, row, column_delta, TILE_CACHE_ROWS);
+        } else if (column_delta < 0) {
+            render_tiles(column, row, -column_delta, TILE_CACHE_ROWS);
+        }
+
+        if (row_delta > 0) {
+            render_tiles(column, cache_row + TILE_CACHE_ROWS, TILE_CACHE_COLUMNS, row_delta);
+        } else if (row_delta < 0) {
+            render_tiles(column, row, TILE_CACHE_COLUMNS, -row_delta);
+        }
+    }
+
+    if ((gpu.tilemap.cache_x != gpu.tilemap.scroll_x) || (gpu.tilemap.cache_y != gpu.tilemap.scroll_y)) {
+        gpu.tilemap.cache_x = gpu.tilemap.scroll_x;
+        gpu.tilemap.cache_y = gpu.tilemap.scroll_y;
+        gpu.tilemap.version++;
+    }
+
+    return CLEAR_TILEMAP | gpu.tilemap.version;
+}
+
+static void fill_from_tilemap(const rect area) {
+    uint16_t cache_x = (gpu.tilemap.cache_x + area.x0) % TILE_CACHE_WIDTH, cache_y;
+    uint16_t width = area.x1 - area.x0 + 1, first_width = MIN(width, TILE_CACHE_WIDTH - cache_x);
+
+    for (uint16_t y = area.y0; y <= area.y1; y++) {
+        cache_y = (gpu.tilemap.cache_y + y) % TILE_CACHE_HEIGHT;
+
+        // the span can wrap around the right edge of the cache
+        memcpy(&gpu.framebuffer[y][area.x0], &gpu.tilemap.cache[cache_y][cache_x], first_width * sizeof(pixel));
+        memcpy(&gpu.framebuffer[y][area.x0 + first_width], &gpu.tilemap.cache[cache_y][0], (width - first_width) * sizeof(pixel));
+    }
+}
+
+static void set_tile(const uint16_t column, const uint16_t row, const uint8_t tile) {
+    uint16_t map_column = column % gpu.tilemap.columns, map_row = row % gpu.tilemap.rows;
+    uint16_t first_column = gpu.tilemap.cache_x / GPU_TILE_WIDTH, first_row = gpu.tilemap.cache_y / GPU_TILE_HEIGHT;
+    int32_t  x, y;
+    rect     area, cell_area;
+
+    gpu.tilemap.map[(map_row * gpu.tilemap.columns) + map_column] = tile;
+
+    if (!gpu.tilemap.is_cache_valid) {
+        return;
+    }
+
+    // a small map repeats, so the tile can be in the cache more than once
+    for (uint16_t cache_row = first_row; cache_row != (uint16_t) (first_row + TILE_CACHE_ROWS); cache_row++) {
+        for (uint16_t cache_column = first_column; cache_column != (uint16_t) (first_column + TILE_CACHE_COLUMNS); cache_column++) {
+            if (((cache_column % gpu.tilemap.columns) != map_column) || ((cache_row % gpu.tilemap.rows) != map_row)) {
+                continue;
+            }
+
+            render_tile(cache_column, cache_row);
+
+            x = (int16_t) (uint16_t) ((cache_column * GPU_TILE_WIDTH) - gpu.tilemap.cache_x);
+            y = (int16_t) (uint16_t) ((cache_row * GPU_TILE_HEIGHT) - gpu.tilemap.cache_y);
+
+            if ((x >= GPU_RESOLUTION_WIDTH) || (y >= GPU_RESOLUTION_HEIGHT) || (x + GPU_TILE_WIDTH <= 0) || (y + GPU_TILE_HEIGHT <= 0)) {
+                continue;
+            }
+
+            area = (rect) {MAX(x, 0), MAX(y, 0), MIN(x + GPU_TILE_WIDTH - 1, GPU_RESOLUTION_WIDTH - 1), MIN(y + GPU_TILE_HEIGHT - 1, GPU_RESOLUTION_HEIGHT - 1)};
+
+            // the next clear restores the tile like anything else that was drawn
+            for (int cell_row = area.y0 / FRAMEBUFFER_CELL_HEIGHT; cell_row <= area.y1 / FRAMEBUFFER_CELL_HEIGHT; cell_row++) {
+                for (int cell_column = area.x0 / FRAMEBUFFER_CELL_WIDTH; cell_column <= area.x1 / FRAMEBUFFER_CELL_WIDTH; cell_column++) {
+                    cell_area.x0 = MAX(area.x0, cell_column * FRAMEBUFFER_CELL_WIDTH);
+                    cell_area.y0 = MAX(area.y0, cell_row * FRAMEBUFFER_CELL_HEIGHT);
+                    cell_area.x1 = MIN(area.x1, ((cell_column + 1) * FRAMEBUFFER_CELL_WIDTH) - 1);
+                    cell_area.y1 = MIN(area.y1, ((cell_row + 1) * FRAMEBUFFER_CELL_HEIGHT) - 1);
+
+                    gpu.cells[cell_row][cell_column].drawn_area = gpu.cells[cell_row][cell_column].is_clear ? cell_area : rect_union(gpu.cells[cell_row][cell_column].drawn_area, cell_area);
+                    gpu.cells[cell_row][cell_column].is_clear   = false;
+                }
+            }
+        }
+    }
+}
+
+static void draw_text(const uint16_t x, const uint16_t y, const char* text, const uint8_t length, const font* text_font) {
+    uint32_t state = get_draw_state();
+    pixel    color = to_pixel(STATE_FOREGROUND(state), STATE_PALETTE(state));
+    pixel*   target;
+    uint16_t glyph_x;
+    uint8_t  glyph, mask, visible_mask;
+    int16_t  first_column, last_column;
+    rect     area;
+
+    if ((length == 0) || !clip_raster_area(x, y, (length * (text_font->char_width + 1)) - 1, text_font->char_height, &area)) {
+        return;
+    }
+
+    begin_area_write(area);
+
+    for (uint8_t char_index = 0; char_index < length; char_index++) {
+        glyph   = (uint8_t) text[char_index];
+        glyph_x = x + (char_index * (text_font->char_width + 1));
+
+        if (glyph_x > area.x1) {
+            break;
+        }
+
+        if ((glyph >= text_font->glyph_count) || (glyph_x + GPU_FONT_MAX_CHAR_WIDTH <= area.x0)) {
+            continue;
+        }
+
+        // the columns outside of the clipped area are masked out
+        first_column = MAX(area.x0 - glyph_x, 0);
+        last_column  = MIN(area.x1 - glyph_x, GPU_FONT_MAX_CHAR_WIDTH - 1);
+        visible_mask = ((1 << (last_column + 1)) - 1) & ~((1 << first_column) - 1);
+
+        for (uint16_t row = area.y0 - y; row <= area.y1 - y; row++) {
+            mask   = text_font->rows[glyph][row] & visible_mask;
+            target = &gpu.framebuffer[y + row][glyph_x];
+
+            for (; mask != 0; mask >>= 1, target++) {
+                if (mask & 1) {
+                    *target = color;
+                }
+            }
+        }
+    }
+}
+
+static uint32_t get_cell_mask(const rect area) {
+    uint32_t mask = 0;
+
+    for (int row = area.y0 / FRAMEBUFFER_CELL_HEIGHT; row <= area.y1 / FRAMEBUFFER_CELL_HEIGHT; row++) {
+        for (int column = area.x0 / FRAMEBUFFER_CELL_WIDTH; column <= area.x1 / FRAMEBUFFER_CELL_WIDTH; column++) {
+            mask |= 1u << ((row * FRAMEBUFFER_COLUMNS) + column);
+        }
+    }
+
+    return mask;
+}
+
+// Returns false for commands that do not draw, or that draw nothing on screen.
+static bool get_command_area(const uint32_t* record, rect* area) {
+    int16_t     x = (int16_t) (record[1] & 0xFFFF), y = (int16_t) (record[1] >> 16);
+    uint16_t    w, h;
+    const font* text_font;
+
+    switch (record[0] & 0xFF) {
+        case COMMAND_CLEAR:
+            *area = (rect) {0, 0, GPU_RESOLUTION_WIDTH - 1, GPU_RESOLUTION_HEIGHT - 1};
+            return true;
+
+        case COMMAND_SET_PIXEL:
+            w = 1;
+            h = 1;
+            break;
+
+        case COMMAND_BLIT:
+            w = record[2] & 0xFFFF;
+            h = record[2] >> 16;
+            break;
+
+        case COMMAND_PRINT_SMALL:
+            text_font = read_pointer(&record[2]);
+            w         = (record[0] >> 16) * (text_font->char_width + 1) - 1;
+            h         = text_font->char_height;
+            break;
+
+        default:
+            return false;
+    }
+
+    return clip_area(x, y, w, h, area);
+}
+
+static void call_list(display_list* list) {
+    uint32_t skip_mask = 0, cell_mask = 0, command_mask, cell;
+    uint32_t state = get_state();
+    uint8_t  command;
+    rect     area;
+
+    // cells nothing else wrote to since the last run of an unchanged list already hold its output
+    if ((list->drawn_version == list->version) && (list->drawn_state == state)) {
+        for (cell = 0; cell < FRAMEBUFFER_ROWS * FRAMEBUFFER_COLUMNS; cell++) {
+            if ((list->cell_mask & (1u << cell)) && (gpu.cells[cell / FRAMEBUFFER_COLUMNS][cell % FRAMEBUFFER_COLUMNS].serial == list->cell_serials[cell])) {
+                skip_mask |= 1u << cell;
+            }
+        }
+    }
+
+    for (uint16_t offset = 0; offset < list->length; offset += (list->words[offset] >> 8) & 0xFF) {
+        command = list->words[offset] & 0xFF;
+
+        if ((command == COMMAND_SYNC) || (command == COMMAND_CALL)) {
+            continue;
+        }
+
+        if (get_command_area(&list->words[offset], &area)) {
+            command_mask = get_cell_mask(area);
+            cell_mask |= command_mask;
+
+            if ((command_mask & ~skip_mask) == 0) {
+                continue;
+            }
+
+            // whatever this command overwrites has to be redrawn by the commands after it
+            skip_mask &= ~command_mask;
+        }
+
+        execute_command(&list->words[offset]);
+    }
+
+#if GPU_SPLIT_RASTER
+    // the serials are only up to date once the list is drawn
+    rasterize_bins();
+#endif
+
+    for (cell = 0; cell < FRAMEBUFFER_ROWS * FRAMEBUFFER_COLUMNS; cell++) {
+        list->cell_serials[cell] = gpu.cells[cell / FRAMEBUFFER_COLUMNS][cell % FRAMEBUFFER_COLUMNS].serial;
+    }
+
+    // the cells of a skipped run do not hold the output of the list
+    list->cell_mask     = gpu.frames.is_skipping ? 0 : cell_mask;
+    list->drawn_version = list->version;
+    list->drawn_state   = state;
+
+    __dmb();
+    list->returns++;
+}
+
+static void patch_list(display_list* list, const uint16_t position, const uint32_t value) {
+    // an unchanged position keeps the cells the list drew
+    if (list->words[position + 1] != value) {
+        list->words[position + 1] = value;
+        list->version++;
+    }
+
+    __dmb();
+    list->returns++;
+}
+
+// Whether a sync starts a new frame, the syncs that come before the frame is due are merged into the next one.
+static bool wait_for_frame(void) {
+    uint64_t now = time_us_64();
+
+    if (gpu.time.last_sync == 0) {
+        gpu.time.last_sync   = now - gpu.time.min_frame;
+        gpu.time.last_vblank = display_get_vblank_count() + 1 - gpu.time.vblank_divisor;
+    }
+
+#if GPU_TEAR_SYNC
+    uint32_t next_vblank = display_get_vblank_count() + 1;
+
+    // frames start with a vertical blank, every vblank_divisor refreshes
+    if (gpu.time.has_tearing_signal) {
+        if ((int32_t) (next_vblank - (gpu.time.last_vblank + gpu.time.vblank_divisor)) < 0) {
+            return false;
+        }
+
+        if (display_wait_vblank(next_vblank)) {
+            gpu.time.last_vblank = next_vblank;
+            return true;
+        }
+
+        // the te pin is not wired, the timer paces the frames from now on
+        gpu.time.has_tearing_signal = false;
+    }
+#endif
+
+    return now - gpu.time.last_sync + (gpu.time.min_frame / FRAME_TIME_SLACK_DIVISOR) >= gpu.time.min_frame;
+}
+
+static inline bool is_drawing_command(const uint8_t command) {
+    return (command == COMMAND_CLEAR) || (command == COMMAND_SET_PIXEL) || (command == COMMAND_BLIT) || (command == COMMAND_PRINT_SMALL);
+}
+
+// Whether the drawing of a frame is wasted: the frame after it is already in the ring (from position on) and clears
+// everything before its first drawing command, so nothing the frame draws can be flushed.
+static bool is_frame_superseded(uint32_t position) {
+    uint32_t      head          = gpu.ring.head;
+    bool          is_sync_found = false;
+    uint32_t*     record;
+    display_list* list;
+    uint8_t       command;
+
+    __dmb();
+
+    for (; position != head; position += (record[0] >> 8) & 0xFF) {
+        record  = &gpu.ring.words[position % GPU_COMMAND_RING_SIZE];
+        command = record[0] & 0xFF;
+
+        if (!is_sync_found) {
+            is_sync_found = (command == COMMAND_SYNC);
+            continue;
+        }
+
+        if (command == COMMAND_CALL) {
+            list = read_pointer(&record[1]);
+
+            // lists cannot call other lists or sync
+            for (uint16_t offset = 0; offset < list->length; offset += (list->words[offset] >> 8) & 0xFF) {
+                if (is_drawing_command(list->words[offset] & 0xFF)) {
+                    return (list->words[offset] & 0xFF) == COMMAND_CLEAR;
+                }
+            }
+        } else if (is_drawing_command(command) || (command == COMMAND_SYNC)) {
+            return command == COMMAND_CLEAR;
+        }
+    }
+
+    return false;
+}
+
+static void change_output_scale(const uint8_t scale) {
+    // the 2x image covered the border
+    if ((scale == GPU_SCALE_1X) && (gpu.output.scale != GPU_SCALE_1X)) {
+        display_clear(BORDER_COLOR);
+    }
+
+    set_output_scale(scale);
+    invalidate_cells();
+}
+
+#if GPU_DIRECT_RENDER
+
+// The back buffer becomes the front one. Its dirty areas are compared with the old front buffer, which holds what
+// the panel shows, so they shrink to the pixels that really changed. Those are copied over, so that core0 goes on
+// drawing on top of the frame it just finished.
+static void swap_buffers(void) {
+    pixel (*back)[GPU_RESOLUTION_WIDTH] = gpu.front;
+    rect    area, changed;
+    bool    is_changed;
+    int16_t start, end;
+
+    // the old front buffer may still be streaming
+    display_wait_all();
+
+    for (int row = 0; row < FRAMEBUFFER_ROWS; row++) {
+        for (int column = 0; column < FRAMEBUFFER_COLUMNS; column++) {
+            if (!gpu.cells[row][column].is_dirty) {
+                continue;
+            }
+
+            area       = gpu.cells[row][column].dirty_area;
+            is_changed = false;
+
+            for (int16_t y = area.y0; y <= area.y1; y++) {
+                for (start = area.x0; (start <= area.x1) && (gpu.framebuffer[y][start] == back[y][start]); start++) {
+                }
+
+                if (start > area.x1) {
+                    continue;
+                }
+
+                for (end = area.x1; gpu.framebuffer[y][end] == back[y][end]; end--) {
+                }
+
+                memcpy(&back[y][start], &gpu.framebuffer[y][start], (end - start + 1) * sizeof(pixel));
+
+                changed    = is_changed ? rect_union(changed, (rect) {start, y, end, y}) : (rect) {start, y, end, y};
+                is_changed = true;
+            }
+
+            if (!gpu.output.is_invalidated) {
+                gpu.cells[row][column].is_dirty   = is_changed;
+                gpu.cells[row][column].dirty_area = is_changed ? changed : area;
+            }
+        }
+    }
+
+    gpu.front       = gpu.framebuffer;
+    gpu.framebuffer = back;
+}
+
+#endif
+
+static void sync_frame(const uint32_t* record) {
+    uint64_t frame_start, frame_end;
+
+    if (gpu.frames.is_skipping) {
+        gpu.frames.stats.skipped++;
+    } else if (!wait_for_frame()) {
+        gpu.frames.stats.dropped++;
+    } else {
+        frame_start = time_us_64();
+
+        gpu.frames.stats.last_latency = (uint32_t) frame_start - record[1];
+        gpu.frames.stats.presented++;
+
+        if (gpu.frames.stats.last_latency > gpu.time.min_frame) {
+            gpu.frames.stats.late++;
+        }
+
+#if GPU_DIRECT_RENDER
+        if (gpu.output.next_scale != gpu.output.scale) {
+            change_output_scale(gpu.output.next_scale);
+        }
+
+        swap_buffers();
+#endif
+
+        flush_cells();
+        display_end_frame();
+
+        frame_end           = time_us_64();
+        gpu.time.last_frame = frame_end - gpu.time.last_sync;
+        gpu.time.last_busy  = gpu.time.frame_busy + (frame_end - frame_start);
+        gpu.time.last_sync  = frame_start;
+        gpu.time.frame_busy = 0;
+    }
+
+    // syncs only run from the ring, where the tail is still on this record
+    gpu.frames.is_skipping = is_frame_superseded(gpu.ring.tail + ((record[0] >> 8) & 0xFF));
+    gpu.frames.synced++;
+}
+
+// Runs one of the commands is_drawing_command() accepts, clipped to what the calling core is drawing.
+static void draw_command(const uint32_t* record) {
+    int      command = record[0] & 0xFF, parameter = record[0] >> 16, row, column;
+    uint32_t clear_key, state = get_draw_state();
+    rect     clear_area, clip = get_raster_clip();
+    uint16_t pixel_x, pixel_y;
+    pixel    color;
+
+    switch (command) {
+        case COMMAND_CLEAR:
+            // with a tilemap the framebuffer is cleared to it instead of the background color
+            color = to_pixel(STATE_BACKGROUND(state), STATE_PALETTE(state));
+#if GPU_SPLIT_RASTER
+            // bin_command() brought the cache up to date, the cores only read it
+            clear_key = (gpu.tilemap.sheet != NULL) ? (CLEAR_TILEMAP | gpu.tilemap.version) : color;
+#else
+            clear_key = (gpu.tilemap.sheet != NULL) ? update_tile_cache() : color;
+#endif
+
+            for (row = clip.y0 / FRAMEBUFFER_CELL_HEIGHT; row <= clip.y1 / FRAMEBUFFER_CELL_HEIGHT; row++) {
+                for (column = clip.x0 / FRAMEBUFFER_CELL_WIDTH; column <= clip.x1 / FRAMEBUFFER_CELL_WIDTH; column++) {
+                    if (gpu.cells[row][column].is_clear && (gpu.cells[row][column].clear_key == clear_key)) {
+                        continue;
+                    }
+
+                    // with the same color only what was drawn since the last clear needs to go
+                    if (gpu.cells[row][column].clear_key == clear_key) {
+                        clear_area = gpu.cells[row][column].drawn_area;
+                    } else {
+                        clear_area = (rect) {
+                            column * FRAMEBUFFER_CELL_WIDTH,
+                            row * FRAMEBUFFER_CELL_HEIGHT,
+                            ((column + 1) * FRAMEBUFFER_CELL_WIDTH) - 1,
+                            ((row + 1) * FRAMEBUFFER_CELL_HEIGHT) - 1,
+                        };
+                    }
+
+                    begin_area_write(clear_area);
+
+                    if (gpu.tilemap.sheet != NULL) {
+                        fill_from_tilemap(clear_area);
+                    } else {
+                        for (pixel_y = clear_area.y0; pixel_y <= clear_area.y1; pixel_y++) {
+                            for (pixel_x = clear_area.x0; pixel_x <= clear_area.x1; pixel_x++) {
+                                gpu.framebuffer[pixel_y][pixel_x] = color;
+                            }
+                        }
+                    }
+
+                    gpu.cells[row][column].is_clear  = true;
+                    gpu.cells[row][column].clear_key = clear_key;
+                }
+            }
+
+            break;
+
+        case COMMAND_SET_PIXEL:
+            if (clip_raster_area((int16_t) (record[1] & 0xFFFF), (int16_t) (record[1] >> 16), 1, 1, &clear_area)) {
+                begin_area_write(clear_area);
+
+                gpu.framebuffer[clear_area.y0][clear_area.x0] = to_pixel((uint8_t) parameter, STATE_PALETTE(state));
+            }
+
+            break;
+
+        case COMMAND_BLIT:
+            if (parameter & BLIT_RLE) {
+                blit_rle((int16_t) (record[1] & 0xFFFF), (int16_t) (record[1] >> 16), record[2] & 0xFFFF, record[2] >> 16, read_pointer(&record[3]), STATE_PALETTE(state));
+            } else {
+                blit((int16_t) (record[1] & 0xFFFF), (int16_t) (record[1] >> 16), record[2] & 0xFFFF, record[2] >> 16, read_pointer(&record[3]), parameter & BLIT_OPAQUE,
+                     STATE_PALETTE(state));
+            }
+
+            break;
+
+        case COMMAND_PRINT_SMALL:
+            draw_text(record[1] & 0xFFFF, record[1] >> 16, (const char*) &record[2 + POINTER_WORDS], parameter, read_pointer(&record[2]));
+            break;
+    }
+}
+
+#if GPU_SPLIT_RASTER
+
+static bool rasterize_next_cell(void) {
+    uint32_t  interrupts;
+    uint8_t   cell;
+    const int core = get_core_num();
+
+    // checked without the lock first, core0 polls this while it waits
+    if (gpu.raster.next >= gpu.raster.count) {
+        return false;
+    }
+
+    interrupts = spin_lock_blocking(gpu.raster.lock);
+
+    if (gpu.raster.next >= gpu.raster.count) {
+        spin_unlock(gpu.raster.lock, interrupts);
+        return false;
+    }
+
+    cell = gpu.raster.cells[gpu.raster.next++];
+    spin_unlock(gpu.raster.lock, interrupts);
+
+    gpu.raster.clips[core] = (rect) {
+        (cell % FRAMEBUFFER_COLUMNS) * FRAMEBUFFER_CELL_WIDTH,
+        (cell / FRAMEBUFFER_COLUMNS) * FRAMEBUFFER_CELL_HEIGHT,
+        ((cell % FRAMEBUFFER_COLUMNS) + 1) * FRAMEBUFFER_CELL_WIDTH - 1,
+        ((cell / FRAMEBUFFER_COLUMNS) + 1) * FRAMEBUFFER_CELL_HEIGHT - 1,
+    };
+
+    for (uint8_t entry = 0; entry < gpu.bins.counts[cell]; entry++) {
+        gpu.raster.states[core] = gpu.bins.words[gpu.bins.entries[cell][entry]];
+        draw_command(&gpu.bins.words[gpu.bins.entries[cell][entry] + 1]);
+    }
+
+    gpu.raster.clips[core] = (rect) {0, 0, GPU_RESOLUTION_WIDTH - 1, GPU_RESOLUTION_HEIGHT - 1};
+
+    interrupts = spin_lock_blocking(gpu.raster.lock);
+    gpu.raster.done++;
+    gpu.frames.stats.rasterized_cells++;
+
+    if (core == 0) {
+        gpu.frames.stats.assisted_cells++;
+    }
+
+    spin_unlock(gpu.raster.lock, interrupts);
+
+    return true;
+}
+
+// Draws everything binned so far, core0 takes cells too whenever it calls gpu_assist() or waits for core1.
+static void rasterize_bins(void) {
+    uint32_t interrupts;
+    uint8_t  count = 0;
+
+    if (gpu.bins.used == 0) {
+        return;
+    }
+
+    for (uint8_t cell = 0; cell < CELL_COUNT; cell++) {
+        if (gpu.bins.counts[cell] > 0) {
+            gpu.raster.cells[count++] = cell;
+        }
+    }
+
+    interrupts       = spin_lock_blocking(gpu.raster.lock);
+    gpu.raster.next  = 0;
+    gpu.raster.done  = 0;
+    gpu.raster.count = count;
+    spin_unlock(gpu.raster.lock, interrupts);
+    __sev();
+
+    while (rasterize_next_cell()) {
+    }
+
+    while (gpu.raster.done != count) {
+        tight_loop_contents();
+    }
+
+    gpu.raster.count = 0;
+    gpu.bins.used    = 0;
+    memset(gpu.bins.counts, 0, sizeof(gpu.bins.counts));
+}
+
+// Whether more commands came to bin with what is in the bins, core1 stops waiting for them as soon as core0 waits
+// (and can take cells) or after RASTER_IDLE_TIME.
+static bool wait_for_more_commands(const uint32_t head) {
+    uint64_t until = time_us_64() + RASTER_IDLE_TIME;
+
+    while ((gpu.bins.used > 0) && !gpu.raster.is_core0_waiting && (gpu.ring.head == head) && (time_us_64() < until)) {
+        best_effort_wfe_or_timeout(from_us_since_boot(until));
+    }
+
+    return gpu.ring.head != head;
+}
+
+static void bin_record(const uint32_t* record, const uint32_t cell_mask) {
+    uint8_t length = (record[0] >> 8) & 0xFF;
+
+    for (uint8_t cell = 0; cell < CELL_COUNT; cell++) {
+        if ((cell_mask & (1u << cell)) && (gpu.bins.counts[cell] == BIN_CAPACITY)) {
+            rasterize_bins();
+            break;
+        }
+    }
+
+    if (gpu.bins.used + 1 + length > BIN_ARENA_WORDS) {
+        rasterize_bins();
+    }
+
+    gpu.bins.words[gpu.bins.used] = get_state();
+    memcpy(&gpu.bins.words[gpu.bins.used + 1], record, length * sizeof(uint32_t));
+
+    for (uint8_t cell = 0; cell < CELL_COUNT; cell++) {
+        if (cell_mask & (1u << cell)) {
+            gpu.bins.entries[cell][gpu.bins.counts[cell]++] = gpu.bins.used;
+        }
+    }
+
+    gpu.bins.used += 1 + length;
+}
+
+// An RLE image is binned as one blit per row of cells, starting at the first row of image data the cells show, so
+// the rows above them are walked once here instead of once for every cell.
+static void bin_rle_blit(const uint32_t* record, const rect area, const uint32_t cell_mask) {
+    uint32_t       band[3 + POINTER_WORDS];
+    int16_t        x = (int16_t) (record[1] & 0xFFFF), y = (int16_t) (record[1] >> 16), first_row, last_row;
+    uint16_t       w = record[2] & 0xFFFF;
+    const uint8_t* data = read_pointer(&record[3]);
+
+    band[0] = record[0];
+
+    for (int cell_row = area.y0 / FRAMEBUFFER_CELL_HEIGHT; cell_row <= area.y1 / FRAMEBUFFER_CELL_HEIGHT; cell_row++) {
+        first_row = MAX(area.y0, cell_row * FRAMEBUFFER_CELL_HEIGHT);
+        last_row  = MIN(area.y1, ((cell_row + 1) * FRAMEBUFFER_CELL_HEIGHT) - 1);
+        data      = skip_rle_rows(data, w, first_row - y);
+        y         = first_row;
+
+        band[1] = (uint16_t) x | ((uint16_t) first_row << 16);
+        band[2] = w | ((last_row - first_row + 1) << 16);
+        write_pointer(&band[3], data);
+        bin_record(band, cell_mask & (((1u << FRAMEBUFFER_COLUMNS) - 1) << (cell_row * FRAMEBUFFER_COLUMNS)));
+    }
+}
+
+static void bin_command(const uint32_t* record) {
+    uint32_t cell_mask;
+    rect     area;
+
+    if (!get_command_area(record, &area)) {
+        return;
+    }
+
+    cell_mask = get_cell_mask(area);
+
+    // brought up to date once here, so the cores only read the cache while they clear (the binned clears read it too)
+    if (((record[0] & 0xFF) == COMMAND_CLEAR) && (gpu.tilemap.sheet != NULL)) {
+        rasterize_bins();
+        update_tile_cache();
+    }
+
+    if (((record[0] & 0xFF) == COMMAND_BLIT) && ((record[0] >> 16) & BLIT_RLE)) {
+        bin_rle_blit(record, area, cell_mask);
+    } else {
+        bin_record(record, cell_mask);
+    }
+}
+
+#endif
+
+// Takes cells from core1 while core0 waits, false when there was nothing to draw.
+static bool assist_raster(void) {
+#if GPU_SPLIT_RASTER
+    return rasterize_next_cell();
+#else
+    return false;
+#endif
+}
+
+void gpu_assist(const uint64_t until) {
+#if GPU_SPLIT_RASTER
+    // core1 can draw what it binned so far, core0 is here to help
+    gpu.raster.is_core0_waiting = true;
+    __sev();
+
+    while (time_us_64() < until) {
+        // core1 signals an event when it publishes cells
+        if (!rasterize_next_cell()) {
+            best_effort_wfe_or_timeout(from_us_since_boot(until));
+        }
+    }
+
+    gpu.raster.is_core0_waiting = false;
+#else
+    if (time_us_64() < until) {
+        sleep_until(from_us_since_boot(until));
+    }
+#endif
+}
+
+static void execute_command(const uint32_t* record) {
+    int            command = record[0] & 0xFF, parameter = record[0] >> 16;
+    sprite*        current;
+    retained_text* text;
+
+    if (is_drawing_command(command)) {
+        // a skipped frame keeps its state changes, whatever it draws would be cleared before the next flush
+        if (gpu.frames.is_skipping) {
+            return;
+        }
+
+#if GPU_SPLIT_RASTER
+        bin_command(record);
+#else
+        draw_command(record);
+#endif
+        return;
+    }
+
+#if GPU_SPLIT_RASTER
+    // the binned commands carry their colors and palette, what else they read has to stay as it is until they are drawn
+    if ((command == COMMAND_SET_SCALE) || (command == COMMAND_SYNC) || (command == COMMAND_CALL) || (command == COMMAND_SET_TILEMAP) ||
+        (command == COMMAND_SCROLL_TILEMAP) || (command == COMMAND_SET_TILE)) {
+        rasterize_bins();
+    }
+#endif
+
+    switch (command) {
+        case COMMAND_SET_TILEMAP:
+            gpu.tilemap.sheet          = read_pointer(&record[2]);
+            gpu.tilemap.map            = read_pointer(&record[2 + POINTER_WORDS]);
+            gpu.tilemap.columns        = record[1] & 0xFFFF;
+            gpu.tilemap.rows           = record[1] >> 16;
+            gpu.tilemap.is_cache_valid = false;
+
+            if ((gpu.tilemap.map == NULL) || (gpu.tilemap.columns == 0) || (gpu.tilemap.rows == 0)) {
+                gpu.tilemap.sheet = NULL;
+            }
+
+            break;
+
+        case COMMAND_SCROLL_TILEMAP:
+            gpu.tilemap.scroll_x = record[1] & 0xFFFF;
+            gpu.tilemap.scroll_y = record[1] >> 16;
+            break;
+
+        case COMMAND_SET_TILE:
+            if (gpu.tilemap.sheet != NULL) {
+                set_tile(record[1] & 0xFFFF, record[1] >> 16, (uint8_t) parameter);
+            }
+
+            break;
+
+        case COMMAND_SET_BACKGROUND_COLOR:
+            gpu.colors.background = parameter;
+            break;
+
+        case COMMAND_SET_FOREGROUND_COLOR:
+            gpu.colors.foreground = parameter;
+            break;
+
+        case COMMAND_SET_PALETTE:
+            if (parameter < GPU_PALETTE_COUNT) {
+                gpu.palette.active_index = (uint8_t) parameter;
+            }
+
+            break;
+
+        case COMMAND_SET_SCALE:
+            if ((parameter != GPU_SCALE_1X) && (parameter != GPU_SCALE_2X)) {
+                break;
+            }
+
+#if GPU_DIRECT_RENDER
+            // the output belongs to core1, which changes it at the next swap
+            gpu.output.next_scale = parameter;
+#else
+            change_output_scale(parameter);
+#endif
+            break;
+
+        case COMMAND_SET_SPRITE:
+            if (parameter >= GPU_MAX_SPRITES) {
+                break;
+            }
+
+            current = &gpu.sprites.pending[parameter];
+
+            current->x          = (int16_t) (record[1] & 0xFFFF);
+            current->y          = (int16_t) (record[1] >> 16);
+            current->w          = record[2] & 0xFFFF;
+            current->h          = record[2] >> 16;
+            current->flags      = record[3] & 0xFF;
+            current->palette    = MIN((record[3] >> 8) & 0xFF, GPU_PALETTE_COUNT - 1);
+            current->priority   = (record[3] >> 16) & 0xFF;
+            current->data       = read_pointer(&record[4]);
+            current->is_visible = current->data != NULL;
+            current->is_changed = true;
+            break;
+
+        case COMMAND_MOVE_SPRITE:
+            if (parameter >= GPU_MAX_SPRITES) {
+                break;
+            }
+
+            current = &gpu.sprites.pending[parameter];
+
+            if ((current->x != (int16_t) (record[1] & 0xFFFF)) || (current->y != (int16_t) (record[1] >> 16))) {
+                current->x          = (int16_t) (record[1] & 0xFFFF);
+                current->y          = (int16_t) (record[1] >> 16);
+                current->is_changed = true;
+            }
+
+            break;
+
+        case COMMAND_HIDE_SPRITE:
+            if ((parameter < GPU_MAX_SPRITES) && gpu.sprites.pending[parameter].is_visible) {
+                gpu.sprites.pending[parameter].is_visible = false;
+                gpu.sprites.pending[parameter].is_changed = true;
+            }
+
+            break;
+
+        case COMMAND_SET_TEXT:
+            if (parameter >= gpu.texts.count) {
+                break;
+            }
+
+            text = &gpu.texts.pending[parameter];
+
+            text->x          = (int16_t) (record[1] & 0xFFFF);
+            text->y          = (int16_t) (record[1] >> 16);
+            text->color      = (GPU_INDEXED_FRAMEBUFFER) ? (record[2] & 0xFF) : gpu.palette.colors[gpu.palette.active_index][record[2] & 0xFF];
+            text->length     = MIN(record[2] >> 16, gpu.texts.capacities[parameter]);
+            text->text_font  = read_pointer(&record[3]);
+            text->is_visible = true;
+            text->is_changed = true;
+            memcpy(text->chars, &record[3 + POINTER_WORDS], text->length);
+            break;
+
+        case COMMAND_HIDE_TEXT:
+            if ((parameter < gpu.texts.count) && gpu.texts.pending[parameter].is_visible) {
+                gpu.texts.pending[parameter].is_visible = false;
+                gpu.texts.pending[parameter].is_changed = true;
+            }
+
+            break;
+
+        case COMMAND_CALL:
+            call_list(read_pointer(&record[1]));
+            break;
+
+        case COMMAND_PATCH_LIST:
+            patch_list(read_pointer(&record[2]), parameter, record[1]);
+            break;
+
+        case COMMAND_SYNC:
+            sync_frame(record);
+            break;
+    }
+}
+
+void gpu_core() {
+    uint32_t* record;
+    uint64_t  command_start;
+
+    // display interrupts are delivered to the core that initializes it
+    display_init();
+
+    for (;;) {
+        while (gpu.ring.tail == gpu.ring.head) {
+            __wfe();
+        }
+
+        __dmb();
+        record        = &gpu.ring.words[gpu.ring.tail % GPU_COMMAND_RING_SIZE];
+        command_start = time_us_64();
+
+        execute_command(record);
+
+#if GPU_SPLIT_RASTER
+        // the ring should only read empty once everything is drawn
+        if ((gpu.ring.tail + ((record[0] >> 8) & 0xFF) == gpu.ring.head) && !wait_for_more_commands(gpu.ring.head)) {
+            rasterize_bins();
+        }
+#endif
+
+        if ((record[0] & 0xFF) != COMMAND_SYNC) {
+            gpu.time.frame_busy += time_us_64() - command_start;
+        }
+
+        // the record can only be overwritten once we are done reading it
+        __dmb();
+        gpu.ring.tail += (record[0] >> 8) & 0xFF;
+        __sev();
+    }
+}
+
+// Holds core0 until its next step is due, rasterizing for core1 meanwhile. With a tearing signal the steps follow
+// the vertical blanks the frames are presented on (so no frame is dropped for being synced early), until is the cpu
+// clock the steps follow otherwise.
+void gpu_wait_for_step(const uint64_t until) {
+#if GPU_TEAR_SYNC
+    uint64_t timeout = time_us_64() + (2 * gpu.time.min_frame);
+
+    if (gpu.time.has_tearing_signal) {
+        gpu.time.step_vblank += gpu.time.vblank_divisor;
+
+        // a step that ran past its vertical blank starts the count again
+        if ((int32_t) (display_get_vblank_count() - gpu.time.step_vblank) >= 0) {
+            gpu.time.step_vblank = display_get_vblank_count();
+            return;
+        }
+
+        // the te pin is not wired when no pulse comes in time, core1 finds out too
+        while (((int32_t) (display_get_vblank_count() - gpu.time.step_vblank) < 0) && (time_us_64() < timeout)) {
+            gpu_assist(time_us_64() + 1);
+        }
+
+        if (time_us_64() < timeout) {
+            return;
+        }
+    }
+#endif
+
+    gpu_assist(until);
+}
+
+uint8_t gpu_init(const uint8_t max_fps) {
+    gpu.colors.background      = 0;
+    gpu.colors.foreground      = 255;
+#if GPU_TEAR_SYNC
+    // a whole number of panel refreshes per frame, the fewest that keep under max_fps
+    gpu.time.vblank_divisor     = MAX(1, (DISPLAY_REFRESH_RATE + max_fps - 1) / max_fps);
+    gpu.time.min_frame          = (1000000 * (uint64_t) gpu.time.vblank_divisor) / DISPLAY_REFRESH_RATE;
+    gpu.time.step_vblank        = 0;
+    gpu.time.has_tearing_signal = true;
+#else
+    gpu.time.vblank_divisor     = 1;
+    gpu.time.min_frame          = 1000000 / (uint64_t) max_fps;
+    gpu.time.has_tearing_signal = false;
+#endif
+    gpu.time.last_sync         = 0;
+    gpu.time.last_frame        = gpu.time.min_frame;
+    gpu.time.last_busy         = 0;
+    gpu.palette.active_index   = 0;
+    gpu.time.frame_busy        = 0;
+    gpu.output.palette         = gpu.palette.colors[0];
+    gpu.ring.head              = 0;
+    gpu.ring.tail              = 0;
+    gpu.ring.write             = 0;
+    gpu.ring.peak_usage        = 0;
+    gpu.ring.batch_depth       = 0;
+    gpu.sprites.count          = 0;
+    gpu.output.overlay_ticket  = 0;
+    gpu.sheets.count           = 0;
+    gpu.tilemap.sheet          = NULL;
+    gpu.tilemap.version        = 0;
+    gpu.text.font_count        = 0;
+    gpu.texts.count            = 0;
+    gpu.texts.arena_used       = 0;
+    gpu.lists.count            = 0;
+    gpu.lists.recording        = NULL;
+    gpu.frames.queued          = 0;
+    gpu.frames.synced          = 0;
+    gpu.frames.throttled       = 0;
+    gpu.frames.is_skipping     = false;
+    gpu.frames.stats           = (gpu_frame_stats) {0};
+    gpu.output.next_scale      = GPU_SCALE_1X;
+
+#if GPU_DIRECT_RENDER
+    gpu.framebuffer = gpu.buffers[0];
+    gpu.front       = gpu.buffers[1];
+#endif
+
+#if GPU_SPLIT_RASTER
+    gpu.bins.used               = 0;
+    gpu.raster.lock             = spin_lock_init(spin_lock_claim_unused(true));
+    gpu.raster.next             = 0;
+    gpu.raster.count            = 0;
+    gpu.raster.done             = 0;
+    gpu.raster.is_core0_waiting = false;
+
+    memset(gpu.bins.counts, 0, sizeof(gpu.bins.counts));
+
+    for (int core = 0; core < 2; core++) {
+        gpu.raster.clips[core] = (rect) {0, 0, GPU_RESOLUTION_WIDTH - 1, GPU_RESOLUTION_HEIGHT - 1};
+    }
+#endif
+
+    set_output_scale(GPU_SCALE_1X);
+    invalidate_cells();
+
+    for (int row = 0; row < FRAMEBUFFER_ROWS; row++) {
+        for (int column = 0; column < FRAMEBUFFER_COLUMNS; column++) {
+            gpu.cells[row][column].drawn_area   = gpu.cells[row][column].dirty_area;
+            gpu.cells[row][column].is_clear     = false;
+            gpu.cells[row][column].serial       = 0;
+            gpu.cells[row][column].flush_ticket = 0;
+            gpu.cells[row][column].clear_key    = 0;
+        }
+    }
+
+    gpu_set_font(gpu_create_font(img_small_font, IMG_SMALL_FONT_WIDTH, IMG_SMALL_FONT_HEIGHT, GPU_SMALL_CHAR_WIDTH, GPU_SMALL_CHAR_HEIGHT));
+    build_palettes();
+    multicore_launch_core1(gpu_core);
+    gpu_clear();
+
+    // the rate the frames are presented at, for cpu_init()
+    return 1000000 / gpu.time.min_frame;
 }
\ No newline at end of file
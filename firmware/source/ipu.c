@@ -1,29 +1,232 @@
 #include "api.h"
+#include "hardware/sync.h"
 #include "pico/stdlib.h"
 
+#include <string.h>
+
 #define MAX_BUTTONS 8
+#define PIN_COUNT   30
+#define MAX_RUN     UINT8_MAX    // steps
+
+// the seed of a recording moves on at every ipu_get_seed(), like a LCG
+#define SEED_MULTIPLIER 1664525
+#define SEED_INCREMENT  1013904223
 
 static const uint8_t BUTTON_PINS[MAX_BUTTONS] = {29, 28, 27, 26, 15, 14, 8, 0};
 
 static struct {
-        uint8_t state;
+        uint8_t  state;
+        uint8_t  levels;      // the debounced levels, without the presses that ended during the step
+        uint8_t  pressed;     // by the events the last read took in
+        uint8_t  released;
+        uint32_t press_times[MAX_BUTTONS];
+        int8_t   buttons[PIN_COUNT];
+
+        // filled by the gpio interrupt (and by ipu_read() with it disabled), drained by ipu_read()
+        struct {
+                ipu_event         events[IPU_EVENT_QUEUE_SIZE];
+                volatile uint32_t head;
+                volatile uint32_t tail;
+                uint8_t           levels;
+                uint32_t          edge_times[MAX_BUTTONS];
+        } queue;
+
+        // what the last read took from the queue
+        ipu_event step_events[IPU_EVENT_QUEUE_SIZE];
+        uint8_t   step_event_count;
+
+        // the stream of ipu_record() or ipu_replay(), run is where the last run starts
+        struct {
+                uint8_t*       buffer;
+                const uint8_t* stream;
+                uint32_t       size;
+                uint32_t       capacity;
+                uint32_t       run;
+                uint8_t        steps;    // replayed from the last run
+        } record;
+
+        uint8_t  mode;
+        uint32_t seed;
+        bool     is_seeded;    // by ipu_record() or ipu_replay(), for good
 } ipu;
 
+// An edge is taken as soon as it comes, the bounces after it are dropped for IPU_DEBOUNCE_TIME. A bounce can leave
+// the pin on the other level, ipu_read() catches those up once the time is over.
+static void __not_in_flash_func(push_edge)(const uint8_t button, const bool is_pressed, const uint32_t time) {
+    if ((((ipu.queue.levels >> button) & 0b1) == is_pressed) || (time - ipu.queue.edge_times[button] < IPU_DEBOUNCE_TIME)) {
+        return;
+    }
+
+    // a full queue drops the edge, ipu_read() catches the level up
+    if (ipu.queue.head - ipu.queue.tail == IPU_EVENT_QUEUE_SIZE) {
+        return;
+    }
+
+    ipu.queue.events[ipu.queue.head % IPU_EVENT_QUEUE_SIZE] = (ipu_event) {time, button, is_pressed};
+    ipu.queue.levels ^= 1 << button;
+    ipu.queue.edge_times[button] = time;
+
+    __dmb();
+    ipu.queue.head++;
+}
+
+static void __not_in_flash_func(edge_handler)(uint gpio, uint32_t events) {
+    uint32_t time = time_us_32();
+
+    if ((gpio >= PIN_COUNT) || (ipu.buttons[gpio] < 0)) {
+        return;
+    }
+
+    // both edges in one interrupt, the level says where it ended
+    if ((events & (GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL)) == (GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL)) {
+        push_edge(ipu.buttons[gpio], gpio_get(gpio), time);
+    } else {
+        push_edge(ipu.buttons[gpio], events & GPIO_IRQ_EDGE_RISE, time);
+    }
+}
+
 void ipu_init(void) {
-    ipu.state = 0;
+    uint32_t time = time_us_32();
+
+    ipu.state            = 0;
+    ipu.levels           = 0;
+    ipu.pressed          = 0;
+    ipu.released         = 0;
+    ipu.queue.head       = 0;
+    ipu.queue.tail       = 0;
+    ipu.queue.levels     = 0;
+    ipu.step_event_count = 0;
+    ipu.mode             = IPU_MODE_LIVE;
+    ipu.is_seeded        = false;
+
+    for (int pin = 0; pin < PIN_COUNT; pin++) {
+        ipu.buttons[pin] = -1;
+    }
 
     for (int button = 0; button < MAX_BUTTONS; button++) {
+        ipu.buttons[BUTTON_PINS[button]] = button;
+        ipu.queue.edge_times[button]     = time - IPU_DEBOUNCE_TIME;
+
         gpio_init(BUTTON_PINS[button]);
         gpio_set_dir(BUTTON_PINS[button], GPIO_IN);
         gpio_pull_down(BUTTON_PINS[button]);
     }
+
+    // the interrupt is taken by the core that called ipu_init
+    gpio_set_irq_enabled_with_callback(BUTTON_PINS[0], GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true, edge_handler);
+
+    for (int button = 1; button < MAX_BUTTONS; button++) {
+        gpio_set_irq_enabled(BUTTON_PINS[button], GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true);
+    }
+}
+
+static void record_step(void) {
+    uint8_t* run = &ipu.record.buffer[ipu.record.run];
+
+    // the same buttons as the last step make its run longer
+    if ((ipu.record.run < ipu.record.size) && (run[0] < MAX_RUN) && (run[1] == ipu.state) && (run[2] == ipu.pressed) && (run[3] == ipu.released)) {
+        run[0]++;
+        return;
+    }
+
+    // a full buffer ends the recording, what it holds still replays
+    if (ipu.record.size + IPU_RECORD_RUN_SIZE > ipu.record.capacity) {
+        ipu.mode = IPU_MODE_LIVE;
+        return;
+    }
+
+    run    = &ipu.record.buffer[ipu.record.size];
+    run[0] = 1;
+    run[1] = ipu.state;
+    run[2] = ipu.pressed;
+    run[3] = ipu.released;
+
+    ipu.record.run = ipu.record.size;
+    ipu.record.size += IPU_RECORD_RUN_SIZE;
+}
+
+static void replay_step(void) {
+    const uint8_t* run;
+
+    if ((ipu.record.run < ipu.record.size) && (ipu.record.stream[ipu.record.run] == ipu.record.steps)) {
+        ipu.record.run += IPU_RECORD_RUN_SIZE;
+        ipu.record.steps = 0;
+    }
+
+    ipu.step_event_count = 0;
+
+    if (ipu.record.run >= ipu.record.size) {
+        ipu.state    = 0;
+        ipu.levels   = 0;
+        ipu.pressed  = 0;
+        ipu.released = 0;
+        ipu.mode     = IPU_MODE_REPLAYED;
+        return;
+    }
+
+    run = &ipu.record.stream[ipu.record.run];
+    ipu.record.steps++;
+
+    ipu.state    = run[1];
+    ipu.pressed  = run[2];
+    ipu.released = run[3];
+    ipu.levels   = ipu.state;
+
+    for (int button = 0; button < MAX_BUTTONS; button++) {
+        if ((ipu.pressed >> button) & 0b1) {
+            ipu.press_times[button] = time_us_32();
+        }
+    }
 }
 
 uint8_t ipu_read(void) {
-    ipu.state = 0;
+    uint32_t  pins, time, interrupts;
+    ipu_event event;
+
+    // the buttons stay queued (and dropped once the queue is full) while a replay runs, and after it
+    if ((ipu.mode == IPU_MODE_REPLAY) || (ipu.mode == IPU_MODE_REPLAYED)) {
+        replay_step();
+        return ipu.state;
+    }
+
+    pins = gpio_get_all();
+    time = time_us_32();
+
+    interrupts = save_and_disable_interrupts();
 
+    // the levels the debouncing missed (and the ones held since before ipu_init)
     for (int button = 0; button < MAX_BUTTONS; button++) {
-        ipu.state |= gpio_get(BUTTON_PINS[button]) << button;
+        push_edge(button, (pins >> BUTTON_PINS[button]) & 0b1, time);
+    }
+
+    restore_interrupts(interrupts);
+
+    ipu.pressed          = 0;
+    ipu.released         = 0;
+    ipu.step_event_count = 0;
+
+    while (ipu.queue.tail != ipu.queue.head) {
+        __dmb();
+        event = ipu.queue.events[ipu.queue.tail % IPU_EVENT_QUEUE_SIZE];
+        ipu.queue.tail++;
+
+        ipu.step_events[ipu.step_event_count++] = event;
+
+        if (event.is_pressed) {
+            ipu.levels |= 1 << event.button;
+            ipu.pressed |= 1 << event.button;
+            ipu.press_times[event.button] = event.time;
+        } else {
+            ipu.levels &= ~(1 << event.button);
+            ipu.released |= 1 << event.button;
+        }
+    }
+
+    // a press shorter than a step still shows as held for one
+    ipu.state = ipu.levels | ipu.pressed;
+
+    if (ipu.mode == IPU_MODE_RECORD) {
+        record_step();
     }
 
     return ipu.state;
@@ -31,4 +234,88 @@ uint8_t ipu_read(void) {
 
 uint8_t ipu_get_state(void) {
     return ipu.state;
-}
\ No newline at end of file
+}
+
+uint8_t ipu_get_pressed(void) {
+    return ipu.pressed;
+}
+
+uint8_t ipu_get_released(void) {
+    return ipu.released;
+}
+
+uint32_t ipu_get_held_time(const uint8_t button) {
+    if ((button >= MAX_BUTTONS) || !((ipu.levels >> button) & 0b1)) {
+        return 0;
+    }
+
+    return time_us_32() - ipu.press_times[button];
+}
+
+const ipu_event* ipu_get_events(uint8_t* count) {
+    *count = ipu.step_event_count;
+    return ipu.step_events;
+}
+
+bool ipu_record(uint8_t* buffer, const uint32_t size) {
+    uint32_t header[] = {IPU_RECORD_MAGIC, time_us_32()};
+
+    if (size < IPU_RECORD_HEADER_SIZE) {
+        return false;
+    }
+
+    memcpy(buffer, header, IPU_RECORD_HEADER_SIZE);
+
+    ipu.record.buffer   = buffer;
+    ipu.record.capacity = size;
+    ipu.record.size     = IPU_RECORD_HEADER_SIZE;
+    ipu.record.run      = IPU_RECORD_HEADER_SIZE;
+    ipu.seed            = header[1];
+    ipu.is_seeded       = true;
+    ipu.mode            = IPU_MODE_RECORD;
+
+    return true;
+}
+
+bool ipu_replay(const uint8_t* stream, const uint32_t size) {
+    uint32_t header[2];
+
+    if ((size < IPU_RECORD_HEADER_SIZE) || ((size - IPU_RECORD_HEADER_SIZE) % IPU_RECORD_RUN_SIZE != 0)) {
+        return false;
+    }
+
+    memcpy(header, stream, IPU_RECORD_HEADER_SIZE);
+
+    if (header[0] != IPU_RECORD_MAGIC) {
+        return false;
+    }
+
+    ipu.record.stream = stream;
+    ipu.record.size   = size;
+    ipu.record.run    = IPU_RECORD_HEADER_SIZE;
+    ipu.record.steps  = 0;
+    ipu.seed          = header[1];
+    ipu.is_seeded     = true;
+    ipu.mode          = IPU_MODE_REPLAY;
+
+    return true;
+}
+
+uint8_t ipu_get_mode(void) {
+    return ipu.mode;
+}
+
+// the buffer keeps what was recorded after the recording ends
+const uint8_t* ipu_get_record(uint32_t* size) {
+    *size = ipu.record.size;
+    return ipu.record.buffer;
+}
+
+uint32_t ipu_get_seed(void) {
+    if (!ipu.is_seeded) {
+        return time_us_32();
+    }
+
+    ipu.seed = (ipu.seed * SEED_MULTIPLIER) + SEED_INCREMENT;
+    return ipu.seed;
+}
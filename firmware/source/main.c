@@ -1,17 +1,81 @@
 #include "api.h"
 #include "pico/stdlib.h"
 
+#include <string.h>
+
 extern void game_pong_loop();
 extern void game_pong_init();
+extern void benchmark_run();
+
+// the native games a cartridge can name
+static const struct {
+        const char*        name;
+        cpu_step_function* init;
+        cpu_step_function* loop;
+} games[] = {
+    {"pong", game_pong_init, game_pong_loop},
+};
+
+#if PICOGAME_INPUT_RECORD
+static uint8_t input_record[IPU_RECORD_SIZE];
+#endif
+
+// games that are not native run on the vm, from the code asset of the cartridge
+static void vm_game_loop() {
+    vm_step();
+
+    if (vm_get_state() == VM_STATE_FAULTED) {
+        gpu_print_small(5, 5, "VM FAULT AT %04X", vm_get_fault_address());
+        gpu_sync();
+
+        for (;;) {
+            tight_loop_contents();
+        }
+    }
+}
 
 int main() {
-    cpu_init(30);
-    gpu_init(30);
+    cart_asset code, replay;
+
+    // the game steps at the rate the frames are presented at
+    cpu_init(gpu_init(30));
     ipu_init();
 
     gpu_set_background_color(0xFF);
     gpu_set_foreground_color(0x00);
 
-    game_pong_init();
-    cpu_run(game_pong_loop);
-}
\ No newline at end of file
+#if PICOGAME_BENCHMARK
+    benchmark_run();
+#endif
+
+    if (cart_init()) {
+        // a cartridge that carries a recording runs it in place of the buttons
+        if (cart_find_asset("replay", &replay)) {
+            ipu_replay(replay.data, replay.size);
+        }
+#if PICOGAME_INPUT_RECORD
+        else {
+            ipu_record(input_record, IPU_RECORD_SIZE);
+        }
+#endif
+
+        for (uint8_t game_index = 0; game_index < count_of(games); game_index++) {
+            if (strncmp(cart_get_game(), games[game_index].name, CART_NAME_LENGTH) == 0) {
+                games[game_index].init();
+                cpu_run(games[game_index].loop);
+            }
+        }
+
+        if (cart_find_asset("code", &code) && vm_load(code.data, code.size)) {
+            cpu_run(vm_game_loop);
+        }
+    }
+
+    gpu_clear();
+    gpu_print_small(5, 5, "UNKNOWN GAME: %s", cart_get_game());
+    gpu_sync();
+
+    for (;;) {
+        tight_loop_contents();
+    }
+}
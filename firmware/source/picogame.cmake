@@ -0,0 +1,90 @@
+# The sources, generated data and options of the firmware, shared by the RP2040 build (CMakeLists.txt) and the host
+# build (../host/CMakeLists.txt). Call picogame_configure() on the executable after adding PICOGAME_SOURCES to it.
+
+find_package(Python3 REQUIRED COMPONENTS Interpreter)
+
+set(PICOGAME_SOURCE_DIR ${CMAKE_CURRENT_LIST_DIR})
+set(PICOGAME_TOOLS_DIR ${CMAKE_CURRENT_LIST_DIR}/../tools)
+
+# the images are converted at build time, see tools/assets.py for the formats
+file(GLOB PICOGAME_ASSETS CONFIGURE_DEPENDS ${PICOGAME_SOURCE_DIR}/assets/*.png)
+
+add_custom_command(
+    OUTPUT ${CMAKE_CURRENT_BINARY_DIR}/assets.c ${CMAKE_CURRENT_BINARY_DIR}/assets.h
+    COMMAND Python3::Interpreter ${PICOGAME_TOOLS_DIR}/assets.py ${CMAKE_CURRENT_BINARY_DIR}/assets.c ${CMAKE_CURRENT_BINARY_DIR}/assets.h ${PICOGAME_ASSETS}
+    DEPENDS ${PICOGAME_TOOLS_DIR}/assets.py ${PICOGAME_ASSETS}
+    COMMENT "Converting assets"
+)
+
+# the cartridge partition has to start after the end of the firmware, on a flash sector boundary
+set(PICOGAME_CART_FLASH_OFFSET 0x100000 CACHE STRING "Flash offset of the cartridge partition")
+set(PICOGAME_CART_FLASH_SIZE 0x100000 CACHE STRING "Size of the cartridge partition")
+
+# the pong cartridge is both built into the firmware (as the default game) and written out as pong.uf2, which can be
+# copied to the board to replace whatever game is in the cartridge partition
+file(GLOB PICOGAME_PONG_CART CONFIGURE_DEPENDS ${PICOGAME_SOURCE_DIR}/carts/pong/*)
+
+add_custom_command(
+    OUTPUT ${CMAKE_CURRENT_BINARY_DIR}/pong.cart ${CMAKE_CURRENT_BINARY_DIR}/pong.uf2 ${CMAKE_CURRENT_BINARY_DIR}/builtin_cart.c
+    COMMAND Python3::Interpreter ${PICOGAME_TOOLS_DIR}/cart.py pong ${PICOGAME_PONG_CART}
+            --output ${CMAKE_CURRENT_BINARY_DIR}/pong.cart
+            --uf2 ${CMAKE_CURRENT_BINARY_DIR}/pong.uf2 --offset ${PICOGAME_CART_FLASH_OFFSET}
+            --c ${CMAKE_CURRENT_BINARY_DIR}/builtin_cart.c --symbol builtin_cart
+    DEPENDS ${PICOGAME_TOOLS_DIR}/cart.py ${PICOGAME_TOOLS_DIR}/assets.py ${PICOGAME_PONG_CART}
+    COMMENT "Packing the pong cartridge"
+)
+
+set(PICOGAME_SOURCES
+    ${PICOGAME_SOURCE_DIR}/benchmark.c
+    ${PICOGAME_SOURCE_DIR}/cart.c
+    ${PICOGAME_SOURCE_DIR}/cpu.c
+    ${PICOGAME_SOURCE_DIR}/display.c
+    ${PICOGAME_SOURCE_DIR}/gpu.c
+    ${PICOGAME_SOURCE_DIR}/ipu.c
+    ${PICOGAME_SOURCE_DIR}/main.c
+    ${PICOGAME_SOURCE_DIR}/pong.c
+    ${PICOGAME_SOURCE_DIR}/vm.c
+    ${CMAKE_CURRENT_BINARY_DIR}/assets.c
+    ${CMAKE_CURRENT_BINARY_DIR}/builtin_cart.c
+)
+
+option(PICOGAME_INDEXED_FRAMEBUFFER "Keep palette indices in the framebuffer and apply the palette at scanout" OFF)
+option(PICOGAME_TEAR_SYNC "Start frames on the tearing effect pulse of the panel (TE wired to GPIO 3), at 70 Hz or a divisor of it" OFF)
+option(PICOGAME_DIRECT_RENDER "Draw on core0 into a back buffer that gpu_sync() swaps, core1 only streams the front one" OFF)
+option(PICOGAME_PIO_DISPLAY "Drive the display bus from a PIO state machine that switches DC itself, at twice the SPI clock" OFF)
+option(PICOGAME_SPLIT_RASTER "Bin the drawing commands by framebuffer cell and rasterize the cells on both cores" OFF)
+option(PICOGAME_INPUT_RECORD "Record the buttons and the seed of the game into RAM, unless the cartridge carries a replay" OFF)
+option(PICOGAME_BENCHMARK "Run the GPU benchmarks at startup instead of the game" OFF)
+
+function(picogame_configure target)
+    target_include_directories(${target} PRIVATE ${PICOGAME_SOURCE_DIR} ${CMAKE_CURRENT_BINARY_DIR})
+    target_compile_definitions(${target} PRIVATE CART_FLASH_OFFSET=${PICOGAME_CART_FLASH_OFFSET} CART_FLASH_SIZE=${PICOGAME_CART_FLASH_SIZE})
+
+    if (PICOGAME_INDEXED_FRAMEBUFFER)
+        target_compile_definitions(${target} PRIVATE GPU_INDEXED_FRAMEBUFFER=1)
+    endif()
+
+    if (PICOGAME_TEAR_SYNC)
+        target_compile_definitions(${target} PRIVATE GPU_TEAR_SYNC=1)
+    endif()
+
+    if (PICOGAME_DIRECT_RENDER)
+        target_compile_definitions(${target} PRIVATE GPU_DIRECT_RENDER=1)
+    endif()
+
+    if (PICOGAME_PIO_DISPLAY)
+        target_compile_definitions(${target} PRIVATE DISPLAY_PIO_BUS=1)
+    endif()
+
+    if (PICOGAME_SPLIT_RASTER)
+        target_compile_definitions(${target} PRIVATE GPU_SPLIT_RASTER=1)
+    endif()
+
+    if (PICOGAME_INPUT_RECORD)
+        target_compile_definitions(${target} PRIVATE PICOGAME_INPUT_RECORD=1)
+    endif()
+
+    if (PICOGAME_BENCHMARK)
+        target_compile_definitions(${target} PRIVATE PICOGAME_BENCHMARK=1)
+    endif()
+endfunction()
@@ -1,28 +1,22 @@
 #include "api.h"
 #include "pico/stdlib.h"
 
-#define PONG_BALL_WIDTH  8
-#define PONG_BALL_HEIGHT 8
-
-#define PONG_BAR_WIDTH  24
-#define PONG_BAR_HEIGHT 4
-
-extern uint8_t img_pong_ball[];
-extern uint8_t img_pong_bar[];
-
 #define MARGIN_SIZE                5
 #define MIN_BALL_X                 0
 #define MIN_BALL_Y                 MARGIN_SIZE + MARGIN_SIZE + GPU_SMALL_CHAR_HEIGHT
-#define MAX_BALL_X                 GPU_RESOLUTION_WIDTH - PONG_BALL_WIDTH
-#define MAX_BALL_Y                 GPU_RESOLUTION_HEIGHT - PONG_BALL_HEIGHT
+#define MAX_BALL_X                 GPU_RESOLUTION_WIDTH - pong.images.ball.w
+#define MAX_BALL_Y                 GPU_RESOLUTION_HEIGHT - pong.images.ball.h
 #define MIN_BALL_SPEED             2
 #define MAX_BALL_SPEED             10
 #define PLAYER_SPEED               2
 #define MIN_PLAYER_X               0
-#define MAX_PLAYER_X               GPU_RESOLUTION_WIDTH - PONG_BAR_WIDTH
+#define MAX_PLAYER_X               GPU_RESOLUTION_WIDTH - pong.images.bar.w
 #define BALL_SPEED_INCREASE_POINTS 10
 #define START_SCORE                10
 
+#define SCENE_LIST_SIZE 32    // words
+#define TEXT_COLOR      0x00
+
 #define STATE_IN_GAME 0
 #define STATE_WON     1
 #define STATE_LOST    2
@@ -42,21 +36,61 @@ static struct {
                 uint16_t y;
         } player;
 
+        struct {
+                cart_asset ball;
+                cart_asset bar;
+        } images;
+
+        struct {
+                uint32_t words[SCENE_LIST_SIZE];
+                gpu_list list;
+                uint16_t ball_position;
+                uint16_t player_position;
+                gpu_text score;
+                gpu_text state;
+        } scene;
+
         uint8_t score;
         uint8_t state;
 } pong;
 
+static void record_scene() {
+    pong.scene.list = gpu_create_list(pong.scene.words, SCENE_LIST_SIZE);
+
+    gpu_begin_list(pong.scene.list);
+    gpu_clear();
+    pong.scene.ball_position = gpu_get_list_position();
+    cart_blit_asset(&pong.images.ball, pong.ball.x, pong.ball.y);
+    pong.scene.player_position = gpu_get_list_position();
+    cart_blit_asset(&pong.images.bar, pong.player.x, pong.player.y);
+    gpu_end_list();
+
+    pong.scene.score = gpu_create_text(16);
+    pong.scene.state = gpu_create_text(16);
+}
+
 void game_pong_init() {
+    uint32_t seed = ipu_get_seed();
+
+    if (pong.scene.list == NULL) {
+        cart_find_asset("pong_ball", &pong.images.ball);
+        cart_find_asset("pong_bar", &pong.images.bar);
+    }
+
     pong.score                       = START_SCORE;
-    pong.ball.x                      = MIN_BALL_X + (time_us_64() % (MAX_BALL_X - MIN_BALL_X));
-    pong.ball.y                      = MIN_BALL_Y + (time_us_64() % (MAX_BALL_Y - MIN_BALL_Y));
+    pong.ball.x                      = MIN_BALL_X + (seed % (MAX_BALL_X - MIN_BALL_X));
+    pong.ball.y                      = MIN_BALL_Y + (seed % (MAX_BALL_Y - MIN_BALL_Y));
     pong.ball.x_direction            = 1;
     pong.ball.y_direction            = 1;
     pong.ball.speed                  = MIN_BALL_SPEED;
     pong.ball.next_speed_increase_at = MIN_BALL_SPEED + BALL_SPEED_INCREASE_POINTS;
-    pong.player.y                    = GPU_RESOLUTION_HEIGHT - (PONG_BAR_HEIGHT + MARGIN_SIZE);
-    pong.player.x                    = MIN_PLAYER_X + (((MAX_PLAYER_X - MIN_PLAYER_X) - PONG_BAR_WIDTH) / 2);
+    pong.player.y                    = GPU_RESOLUTION_HEIGHT - (pong.images.bar.h + MARGIN_SIZE);
+    pong.player.x                    = MIN_PLAYER_X + (((MAX_PLAYER_X - MIN_PLAYER_X) - pong.images.bar.w) / 2);
     pong.state                       = STATE_IN_GAME;
+
+    if (pong.scene.list == NULL) {
+        record_scene();
+    }
 }
 
 void update_player() {
@@ -106,10 +140,10 @@ void update_ball() {
 }
 
 void check_collision() {
-    if ((pong.player.x <= (pong.ball.x + PONG_BALL_WIDTH)) &&
-        ((pong.player.x + PONG_BAR_WIDTH) >= pong.ball.x) &&
-        (pong.player.y <= (pong.ball.y + PONG_BALL_HEIGHT)) &&
-        ((pong.player.y + PONG_BAR_HEIGHT) >= pong.ball.y)) {
+    if ((pong.player.x <= (pong.ball.x + pong.images.ball.w)) &&
+        ((pong.player.x + pong.images.bar.w) >= pong.ball.x) &&
+        (pong.player.y <= (pong.ball.y + pong.images.ball.h)) &&
+        ((pong.player.y + pong.images.bar.h) >= pong.ball.y)) {
         pong.ball.y_direction = pong.ball.y > pong.player.y ? 1 : -1;
         pong.ball.x_direction = pong.ball.x > pong.player.x ? 1 : -1;
         pong.score++;
@@ -132,16 +166,19 @@ void check_score() {
 }
 
 void update_screen() {
-    gpu_clear();
-    gpu_blit(pong.ball.x, pong.ball.y, PONG_BALL_WIDTH, PONG_BALL_HEIGHT, img_pong_ball);
-    gpu_blit(pong.player.x, pong.player.y, PONG_BAR_WIDTH, PONG_BAR_HEIGHT, img_pong_bar);
+    gpu_patch_list_position(pong.scene.list, pong.scene.ball_position, pong.ball.x, pong.ball.y);
+    gpu_patch_list_position(pong.scene.list, pong.scene.player_position, pong.player.x, pong.player.y);
+    gpu_call_list(pong.scene.list);
 
-    gpu_print_small(GPU_PRINT_RIGHT - 5, 5, "SCORE: %03d", pong.score);
+    // retained texts only reach the gpu when they change
+    gpu_set_text(pong.scene.score, GPU_PRINT_RIGHT - 5, 5, TEXT_COLOR, "SCORE: %03d", pong.score);
 
     if (pong.state == STATE_WON) {
-        gpu_print_small(5, 5, "YOU WON!");
+        gpu_set_text(pong.scene.state, 5, 5, TEXT_COLOR, "YOU WON!");
     } else if (pong.state == STATE_LOST) {
-        gpu_print_small(5, 5, "YOU LOST!");
+        gpu_set_text(pong.scene.state, 5, 5, TEXT_COLOR, "YOU LOST!");
+    } else {
+        gpu_hide_text(pong.scene.state);
     }
 
     gpu_sync();
@@ -0,0 +1,546 @@
+#include "api.h"
+#include "pico/stdlib.h"
+
+#include <string.h>
+
+static struct {
+        const uint8_t* code;
+        uint32_t       code_size;
+        uint32_t       pc;
+        uint8_t        state;
+        uint32_t       fault_address;
+
+        int32_t  stack[VM_STACK_SIZE];
+        uint16_t stack_depth;
+
+        uint16_t calls[VM_CALL_DEPTH];
+        uint8_t  call_depth;
+
+        int32_t globals[VM_GLOBAL_COUNT];
+} vm;
+
+bool vm_load(const uint8_t* code, const uint32_t size) {
+    // addresses are 16-bit and the last instruction has to stop the machine for it not to run off the end
+    if ((code == NULL) || (size == 0) || (size > UINT16_MAX + 1) || ((code[size - 1] != VM_OP_HALT) && (code[size - 1] != VM_OP_RET))) {
+        vm.state = VM_STATE_HALTED;
+        return false;
+    }
+
+    vm.code        = code;
+    vm.code_size   = size;
+    vm.pc          = 0;
+    vm.state       = VM_STATE_RUNNING;
+    vm.stack_depth = 0;
+    vm.call_depth  = 0;
+
+    memset(vm.globals, 0, sizeof(vm.globals));
+
+    return true;
+}
+
+// The syscall passes the formatter one integer, so the text can hold one integer conversion at most (and no %s).
+static bool is_safe_format(const char* text, const uint32_t max_length) {
+    bool    is_conversion = false;
+    uint8_t value_count   = 0;
+
+    for (uint32_t index = 0; index < max_length; index++) {
+        if (text[index] == 0) {
+            return true;
+        }
+
+        if (!is_conversion) {
+            is_conversion = text[index] == '%';
+            continue;
+        }
+
+        if (strchr("-0123456789l", text[index]) != NULL) {
+            continue;
+        }
+
+        is_conversion = false;
+
+        if ((text[index] == 's') || ((strchr("diuxXc", text[index]) != NULL) && (++value_count > 1))) {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+// Runs a syscall on the stack (top at sp[-1]) and returns the new top, or NULL when the arguments are not valid.
+static int32_t* run_syscall(const uint8_t number, int32_t* sp, const int32_t* stack) {
+    cart_asset asset;
+
+#define ARGUMENTS(count)                   \
+    if (sp - stack < (count)) {            \
+        return NULL;                       \
+    }                                      \
+    sp -= (count);
+
+    switch (number) {
+        case VM_SYS_SYNC:
+            gpu_sync();
+            return sp;
+
+        case VM_SYS_CLEAR:
+            gpu_clear();
+            return sp;
+
+        case VM_SYS_SET_BACKGROUND:
+            ARGUMENTS(1);
+            gpu_set_background_color(sp[0]);
+            return sp;
+
+        case VM_SYS_SET_FOREGROUND:
+            ARGUMENTS(1);
+            gpu_set_foreground_color(sp[0]);
+            return sp;
+
+        case VM_SYS_SET_PALETTE:
+            ARGUMENTS(1);
+            gpu_set_palette(sp[0]);
+            return sp;
+
+        case VM_SYS_SET_SCALE:
+            ARGUMENTS(1);
+            gpu_set_scale(sp[0]);
+            return sp;
+
+        case VM_SYS_SET_PIXEL:
+            ARGUMENTS(3);
+            gpu_set_pixel(sp[0], sp[1], sp[2]);
+            return sp;
+
+        case VM_SYS_BLIT_ASSET:
+            ARGUMENTS(3);
+
+            if (!cart_get_asset(sp[0], &asset)) {
+                return NULL;
+            }
+
+            cart_blit_asset(&asset, sp[1], sp[2]);
+            return sp;
+
+        case VM_SYS_PRINT:
+            ARGUMENTS(4);
+
+            if (((uint32_t) sp[2] >= vm.code_size) || !is_safe_format((const char*) &vm.code[sp[2]], vm.code_size - sp[2])) {
+                return NULL;
+            }
+
+            gpu_print_small(sp[0], sp[1], (const char*) &vm.code[sp[2]], sp[3]);
+            return sp;
+
+        case VM_SYS_SET_SPRITE:
+            ARGUMENTS(7);
+
+            // sprites read their pixels while the frame is sent out, so the asset has to hold all of them
+            if (((uint32_t) sp[0] >= GPU_MAX_SPRITES) || !cart_get_asset(sp[3], &asset) ||
+                ((asset.format != CART_ASSET_OPAQUE) && (asset.format != CART_ASSET_KEYED)) || (asset.size < asset.w * asset.h)) {
+                return NULL;
+            }
+
+            gpu_set_sprite(sp[0], sp[1], sp[2], asset.w, asset.h, asset.data, sp[4], sp[5], sp[6]);
+            return sp;
+
+        case VM_SYS_MOVE_SPRITE:
+            ARGUMENTS(3);
+
+            if ((uint32_t) sp[0] >= GPU_MAX_SPRITES) {
+                return NULL;
+            }
+
+            gpu_move_sprite(sp[0], sp[1], sp[2]);
+            return sp;
+
+        case VM_SYS_HIDE_SPRITE:
+            ARGUMENTS(1);
+
+            if ((uint32_t) sp[0] >= GPU_MAX_SPRITES) {
+                return NULL;
+            }
+
+            gpu_hide_sprite(sp[0]);
+            return sp;
+
+        case VM_SYS_READ_BUTTONS:
+            if (sp - stack >= VM_STACK_SIZE) {
+                return NULL;
+            }
+
+            *sp++ = ipu_read();
+            return sp;
+
+        case VM_SYS_GET_BUTTONS:
+            if (sp - stack >= VM_STACK_SIZE) {
+                return NULL;
+            }
+
+            *sp++ = ipu_get_state();
+            return sp;
+
+        case VM_SYS_GET_TIME:
+            if (sp - stack >= VM_STACK_SIZE) {
+                return NULL;
+            }
+
+            *sp++ = (int32_t) time_us_32();
+            return sp;
+
+        case VM_SYS_GET_PRESSED:
+            if (sp - stack >= VM_STACK_SIZE) {
+                return NULL;
+            }
+
+            *sp++ = ipu_get_pressed();
+            return sp;
+
+        case VM_SYS_GET_RELEASED:
+            if (sp - stack >= VM_STACK_SIZE) {
+                return NULL;
+            }
+
+            *sp++ = ipu_get_released();
+            return sp;
+
+        case VM_SYS_GET_SEED:
+            if (sp - stack >= VM_STACK_SIZE) {
+                return NULL;
+            }
+
+            *sp++ = (int32_t) ipu_get_seed();
+            return sp;
+    }
+
+#undef ARGUMENTS
+
+    return NULL;
+}
+
+// Dispatch is threaded: every handler ends with its own indirect jump to the next one, which saves the range check
+// and the jump back to the top of a switch on every instruction. The machine state lives in locals while it runs,
+// and the interpreter stays in RAM so the code being run has the XIP cache to itself.
+void __not_in_flash_func(vm_step)(void) {
+    static const void* const handlers[256] = {
+        [0 ... 255]    = &&invalid,
+        [VM_OP_HALT]   = &&op_halt,
+        [VM_OP_YIELD]  = &&op_yield,
+        [VM_OP_PUSH8]  = &&op_push8,
+        [VM_OP_PUSH16] = &&op_push16,
+        [VM_OP_PUSH32] = &&op_push32,
+        [VM_OP_DUP]    = &&op_dup,
+        [VM_OP_DROP]   = &&op_drop,
+        [VM_OP_SWAP]   = &&op_swap,
+        [VM_OP_OVER]   = &&op_over,
+        [VM_OP_LOAD]   = &&op_load,
+        [VM_OP_STORE]  = &&op_store,
+        [VM_OP_LOADI]  = &&op_loadi,
+        [VM_OP_STOREI] = &&op_storei,
+        [VM_OP_ADD]    = &&op_add,
+        [VM_OP_SUB]    = &&op_sub,
+        [VM_OP_MUL]    = &&op_mul,
+        [VM_OP_DIV]    = &&op_div,
+        [VM_OP_MOD]    = &&op_mod,
+        [VM_OP_AND]    = &&op_and,
+        [VM_OP_OR]     = &&op_or,
+        [VM_OP_XOR]    = &&op_xor,
+        [VM_OP_SHL]    = &&op_shl,
+        [VM_OP_SHR]    = &&op_shr,
+        [VM_OP_NEG]    = &&op_neg,
+        [VM_OP_NOT]    = &&op_not,
+        [VM_OP_EQ]     = &&op_eq,
+        [VM_OP_NE]     = &&op_ne,
+        [VM_OP_LT]     = &&op_lt,
+        [VM_OP_LE]     = &&op_le,
+        [VM_OP_GT]     = &&op_gt,
+        [VM_OP_GE]     = &&op_ge,
+        [VM_OP_JMP]    = &&op_jmp,
+        [VM_OP_JZ]     = &&op_jz,
+        [VM_OP_JNZ]    = &&op_jnz,
+        [VM_OP_CALL]   = &&op_call,
+        [VM_OP_RET]    = &&op_ret,
+        [VM_OP_SYS]    = &&op_sys,
+    };
+
+    const uint8_t* code    = vm.code;
+    int32_t*       stack   = vm.stack;
+    int32_t*       globals = vm.globals;
+    int32_t        budget  = VM_STEP_BUDGET;
+    const uint8_t* pc;
+    const uint8_t* block;
+    int32_t*       sp;
+    uint32_t       target;
+
+    if (vm.state != VM_STATE_RUNNING) {
+        return;
+    }
+
+    pc    = code + vm.pc;
+    block = pc;
+    sp    = stack + vm.stack_depth;
+
+#define NEXT()  goto *handlers[*pc++]
+// the operands have to end before the last byte, which is always an opcode (see vm_load())
+#define OPERANDS(n) \
+    if (pc + (n) >= code + vm.code_size) goto fault
+#define NEED(n) \
+    if (sp - stack < (n)) goto fault
+#define ROOM(n) \
+    if (sp - stack > VM_STACK_SIZE - (n)) goto fault
+#define BINARY(expression)    \
+    NEED(2);                  \
+    sp--;                     \
+    sp[-1] = (expression);    \
+    NEXT()
+
+// taken branches pay for the code run since the last one
+#define BRANCH(address)                    \
+    target = (address);                    \
+    if (target >= vm.code_size) goto fault;\
+    budget -= pc - block;                  \
+    pc    = code + target;                 \
+    block = pc;                            \
+    if (budget <= 0) goto save;            \
+    NEXT()
+
+#define OPERAND16() ((uint16_t) (pc[0] | (pc[1] << 8)))
+
+    NEXT();
+
+op_halt:
+    vm.state = VM_STATE_HALTED;
+    goto save;
+
+op_yield:
+    goto save;
+
+op_push8:
+    OPERANDS(1);
+    ROOM(1);
+    *sp++ = (int8_t) *pc++;
+    NEXT();
+
+op_push16:
+    OPERANDS(2);
+    ROOM(1);
+    *sp++ = (int16_t) OPERAND16();
+    pc += 2;
+    NEXT();
+
+op_push32:
+    OPERANDS(4);
+    ROOM(1);
+    *sp++ = (int32_t) (pc[0] | (pc[1] << 8) | (pc[2] << 16) | ((uint32_t) pc[3] << 24));
+    pc += 4;
+    NEXT();
+
+op_dup:
+    NEED(1);
+    ROOM(1);
+    sp[0] = sp[-1];
+    sp++;
+    NEXT();
+
+op_drop:
+    NEED(1);
+    sp--;
+    NEXT();
+
+op_swap:
+    NEED(2);
+    target = sp[-1];
+    sp[-1] = sp[-2];
+    sp[-2] = target;
+    NEXT();
+
+op_over:
+    NEED(2);
+    ROOM(1);
+    sp[0] = sp[-2];
+    sp++;
+    NEXT();
+
+op_load:
+    OPERANDS(1);
+    ROOM(1);
+    *sp++ = globals[*pc++];
+    NEXT();
+
+op_store:
+    OPERANDS(1);
+    NEED(1);
+    globals[*pc++] = *--sp;
+    NEXT();
+
+op_loadi:
+    NEED(1);
+    sp[-1] = globals[sp[-1] & (VM_GLOBAL_COUNT - 1)];
+    NEXT();
+
+op_storei:
+    NEED(2);
+    sp -= 2;
+    globals[sp[1] & (VM_GLOBAL_COUNT - 1)] = sp[0];
+    NEXT();
+
+op_add:
+    BINARY(sp[-1] + sp[0]);
+
+op_sub:
+    BINARY(sp[-1] - sp[0]);
+
+op_mul:
+    BINARY(sp[-1] * sp[0]);
+
+op_div:
+    NEED(2);
+
+    if (sp[-1] == 0) {
+        goto fault;
+    }
+
+    sp--;
+    sp[-1] = (sp[0] == -1) ? (int32_t) (0 - (uint32_t) sp[-1]) : sp[-1] / sp[0];
+    NEXT();
+
+op_mod:
+    NEED(2);
+
+    if (sp[-1] == 0) {
+        goto fault;
+    }
+
+    sp--;
+    sp[-1] = (sp[0] == -1) ? 0 : sp[-1] % sp[0];
+    NEXT();
+
+op_and:
+    BINARY(sp[-1] & sp[0]);
+
+op_or:
+    BINARY(sp[-1] | sp[0]);
+
+op_xor:
+    BINARY(sp[-1] ^ sp[0]);
+
+op_shl:
+    BINARY((int32_t) ((uint32_t) sp[-1] << (sp[0] & 31)));
+
+op_shr:
+    BINARY(sp[-1] >> (sp[0] & 31));
+
+op_neg:
+    NEED(1);
+    sp[-1] = (int32_t) (0 - (uint32_t) sp[-1]);
+    NEXT();
+
+op_not:
+    NEED(1);
+    sp[-1] = ~sp[-1];
+    NEXT();
+
+op_eq:
+    BINARY(sp[-1] == sp[0]);
+
+op_ne:
+    BINARY(sp[-1] != sp[0]);
+
+op_lt:
+    BINARY(sp[-1] < sp[0]);
+
+op_le:
+    BINARY(sp[-1] <= sp[0]);
+
+op_gt:
+    BINARY(sp[-1] > sp[0]);
+
+op_ge:
+    BINARY(sp[-1] >= sp[0]);
+
+op_jmp:
+    OPERANDS(2);
+    BRANCH(OPERAND16());
+
+op_jz:
+    OPERANDS(2);
+    NEED(1);
+
+    if (*--sp != 0) {
+        pc += 2;
+        NEXT();
+    }
+
+    BRANCH(OPERAND16());
+
+op_jnz:
+    OPERANDS(2);
+    NEED(1);
+
+    if (*--sp == 0) {
+        pc += 2;
+        NEXT();
+    }
+
+    BRANCH(OPERAND16());
+
+op_call:
+    OPERANDS(2);
+
+    if (vm.call_depth >= VM_CALL_DEPTH) {
+        goto fault;
+    }
+
+    vm.calls[vm.call_depth++] = (pc + 2) - code;
+    BRANCH(OPERAND16());
+
+op_ret:
+    // returning from the top level ends the program
+    if (vm.call_depth == 0) {
+        vm.state = VM_STATE_HALTED;
+        goto save;
+    }
+
+    BRANCH(vm.calls[--vm.call_depth]);
+
+op_sys:
+    OPERANDS(1);
+
+    // a failed syscall leaves the stack as it was before it
+    vm.stack_depth = sp - stack;
+    sp             = run_syscall(*pc++, sp, stack);
+
+    if (sp == NULL) {
+        sp = stack + vm.stack_depth;
+        pc--;
+        goto fault;
+    }
+
+    NEXT();
+
+invalid:
+fault:
+    // pc is right past the opcode of the failed instruction
+    vm.state         = VM_STATE_FAULTED;
+    vm.fault_address = (pc - 1) - code;
+    goto save;
+
+save:
+    vm.pc          = pc - code;
+    vm.stack_depth = sp - stack;
+
+#undef NEXT
+#undef OPERANDS
+#undef NEED
+#undef ROOM
+#undef BINARY
+#undef BRANCH
+#undef OPERAND16
+}
+
+uint8_t vm_get_state(void) {
+    return vm.state;
+}
+
+uint32_t vm_get_fault_address(void) {
+    return vm.fault_address;
+}
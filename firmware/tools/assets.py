@@ -0,0 +1,234 @@
+#!/usr/bin/env python3
+#
+# Converts the PNG assets into packed C data for the firmware.
+#
+#   assets.py <output.c> <output.h> <image.png>...
+#
+# Colors are quantized to the RRRGGGBB indices of the default palette. Index 0 is transparent, so fully black and
+# transparent (alpha < 128) pixels both end up as 0. Each image is emitted in the smallest format that keeps it
+# drawable:
+#
+#   - opaque images (no index 0) as raw indices, for gpu_blit_opaque()
+#   - images with transparency as raw indices or RLE rows, whichever is smaller, for gpu_blit() or gpu_blit_rle()
+#   - images named *_font.png as 1bpp rows, for gpu_create_font()
+#
+# Only non-interlaced 8-bit gray, RGB, gray + alpha, RGBA and palette images are supported, which is what the usual
+# editors write.
+
+import os
+import struct
+import sys
+import zlib
+
+RLE_OPAQUE_RUN = 0x80   # GPU_RLE_OPAQUE_RUN
+BYTES_PER_LINE = 24
+
+CHANNELS = {0: 1, 2: 3, 3: 1, 4: 2, 6: 4}
+
+
+def fail(path, message):
+    sys.exit("%s: %s" % (path, message))
+
+
+def paeth(a, b, c):
+    p = a + b - c
+    pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+
+    if (pa <= pb) and (pa <= pc):
+        return a
+
+    return b if pb <= pc else c
+
+
+def read_png(path):
+    with open(path, "rb") as file:
+        data = file.read()
+
+    if data[:8] != b"\x89PNG\r\n\x1a\n":
+        fail(path, "not a PNG file")
+
+    offset, compressed, palette, alphas = 8, b"", None, b""
+
+    while offset < len(data):
+        length, kind = struct.unpack(">I4s", data[offset:offset + 8])
+        chunk = data[offset + 8:offset + 8 + length]
+        offset += 12 + length
+
+        if kind == b"IHDR":
+            w, h, depth, color_type, _, _, interlace = struct.unpack(">IIBBBBB", chunk)
+        elif kind == b"PLTE":
+            palette = [tuple(chunk[index:index + 3]) for index in range(0, length, 3)]
+        elif kind == b"tRNS":
+            alphas = chunk
+        elif kind == b"IDAT":
+            compressed += chunk
+        elif kind == b"IEND":
+            break
+
+    if (depth != 8) or (color_type not in CHANNELS) or (interlace != 0):
+        fail(path, "only non-interlaced 8-bit images are supported")
+
+    channels = CHANNELS[color_type]
+    stride   = w * channels
+    raw      = zlib.decompress(compressed)
+    previous = bytearray(stride)
+    pixels   = []
+
+    for y in range(h):
+        kind = raw[y * (stride + 1)]
+        line = bytearray(raw[(y * (stride + 1)) + 1:(y + 1) * (stride + 1)])
+
+        for x in range(stride):
+            left   = line[x - channels] if x >= channels else 0
+            up     = previous[x]
+            corner = previous[x - channels] if x >= channels else 0
+
+            if kind == 1:
+                line[x] = (line[x] + left) & 0xFF
+            elif kind == 2:
+                line[x] = (line[x] + up) & 0xFF
+            elif kind == 3:
+                line[x] = (line[x] + ((left + up) >> 1)) & 0xFF
+            elif kind == 4:
+                line[x] = (line[x] + paeth(left, up, corner)) & 0xFF
+
+        for x in range(w):
+            values = line[x * channels:(x + 1) * channels]
+
+            if color_type == 0:
+                pixels.append((values[0], values[0], values[0], 255))
+            elif color_type == 2:
+                pixels.append((values[0], values[1], values[2], 255))
+            elif color_type == 3:
+                alpha = alphas[values[0]] if values[0] < len(alphas) else 255
+                pixels.append(palette[values[0]] + (alpha,))
+            elif color_type == 4:
+                pixels.append((values[0], values[0], values[0], values[1]))
+            else:
+                pixels.append(tuple(values))
+
+        previous = line
+
+    return w, h, pixels
+
+
+def quantize(pixel):
+    red, green, blue, alpha = pixel
+
+    if alpha < 128:
+        return 0
+
+    # the top bits of each channel, which is how the existing art was converted
+    return (red & 0b11100000) | ((green & 0b11100000) >> 3) | (blue >> 6)
+
+
+# same layout as copy_rle_row(): bytes below 0x80 skip (b + 1) pixels, the others are followed by ((b & 0x7F) + 1)
+# indices
+def encode_rle(indices, w, h):
+    rows = []
+
+    for y in range(h):
+        source, row, x = indices[y * w:(y + 1) * w], [], 0
+
+        while x < w:
+            is_opaque, run_length = source[x] != 0, 1
+
+            while (x + run_length < w) and ((source[x + run_length] != 0) == is_opaque) and (run_length < RLE_OPAQUE_RUN):
+                run_length += 1
+
+            if is_opaque:
+                row += [RLE_OPAQUE_RUN | (run_length - 1)] + source[x:x + run_length]
+            else:
+                row.append(run_length - 1)
+
+            x += run_length
+
+        rows.append(row)
+
+    return rows
+
+
+# bit 0 of each byte is the leftmost pixel, rows are padded to whole bytes
+def encode_bits(indices, w, h):
+    rows = []
+
+    for y in range(h):
+        row = [0] * ((w + 7) // 8)
+
+        for x in range(w):
+            if indices[(y * w) + x] != 0:
+                row[x // 8] |= 1 << (x % 8)
+
+        rows.append(row)
+
+    return rows
+
+
+def convert(path):
+    name         = os.path.splitext(os.path.basename(path))[0].lower().replace("-", "_")
+    w, h, pixels = read_png(path)
+    indices      = [quantize(pixel) for pixel in pixels]
+
+    if name.endswith("_font"):
+        return name, w, h, "FONT", None, encode_bits(indices, w, h)
+
+    raw = [indices[y * w:(y + 1) * w] for y in range(h)]
+
+    if 0 not in indices:
+        return name, w, h, "OPAQUE", "gpu_blit_opaque", raw
+
+    rle = encode_rle(indices, w, h)
+
+    if sum(len(row) for row in rle) < w * h:
+        return name, w, h, "RLE", "gpu_blit_rle", rle
+
+    return name, w, h, "KEYED", "gpu_blit", raw
+
+
+def format_rows(rows):
+    lines = []
+
+    for row in rows:
+        for start in range(0, len(row), BYTES_PER_LINE):
+            lines.append("    " + ", ".join("0x%02x" % value for value in row[start:start + BYTES_PER_LINE]) + ",")
+
+    return "\n".join(lines)
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit("usage: assets.py <output.c> <output.h> <image.png>...")
+
+    assets = [convert(path) for path in sorted(sys.argv[3:])]
+    header = os.path.basename(sys.argv[2])
+
+    with open(sys.argv[1], "w") as source:
+        source.write("// generated by tools/assets.py, do not edit\n\n")
+        source.write('#include "%s"\n' % header)
+
+        for name, w, h, kind, blit, rows in assets:
+            source.write("\nconst uint8_t __in_flash() img_%s[] = {\n%s\n};\n" % (name, format_rows(rows)))
+
+    with open(sys.argv[2], "w") as output:
+        output.write("// generated by tools/assets.py, do not edit\n\n")
+        output.write("#ifndef ASSETS_H\n#define ASSETS_H\n\n")
+        output.write('#include "pico/stdlib.h"\n')
+
+        for name, w, h, kind, blit, rows in assets:
+            prefix = "IMG_" + name.upper()
+            size   = sum(len(row) for row in rows)
+
+            output.write("\n// %s, %dx%d, %s, %d bytes\n" % (os.path.basename(name), w, h, kind.lower(), size))
+            output.write("#define %s_WIDTH  %d\n" % (prefix, w))
+            output.write("#define %s_HEIGHT %d\n" % (prefix, h))
+
+            if blit is not None:
+                output.write("#define %s_BLIT   %s\n" % (prefix, blit))
+
+            output.write("\nextern const uint8_t img_%s[];\n" % name)
+
+        output.write("\n#endif\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+#
+# Packs a game and its assets into a cartridge image.
+#
+#   cart.py <game> <file>... [--output game.cart] [--uf2 game.uf2 --offset 0x100000] [--c game_cart.c --symbol name]
+#
+# The image is a 32 bytes header, one 32 bytes index entry per asset and the asset blobs, each starting on a 4 bytes
+# boundary (all little endian):
+#
+#   header: magic "PCRT", uint16 version, uint16 asset count, uint32 image size, uint32 checksum, char game[16]
+#   entry:  char name[16], uint32 offset, uint32 size, uint16 width, uint16 height, uint8 format, 3 bytes padding
+#
+# The checksum is the 32-bit sum of the words after the header. Assets are named after their file without the
+# extension. PNG files are converted like tools/assets.py does, any other file is stored as is (the VM runs the
+# one named code). The UF2 file writes the image to the
+# cartridge partition (at the given flash offset) without touching the firmware.
+
+import argparse
+import os
+import struct
+import sys
+
+import assets
+
+MAGIC          = b"PCRT"
+VERSION        = 1
+NAME_LENGTH    = 16
+HEADER_SIZE    = 32
+ENTRY_SIZE     = 32
+XIP_BASE       = 0x10000000
+UF2_BLOCK_DATA = 256
+UF2_FAMILY     = 0xE48BFF56     # RP2040
+
+# same values as CART_ASSET_* in api.h
+FORMATS = {"OPAQUE": 0, "KEYED": 1, "RLE": 2, "FONT": 3, "DATA": 4}
+
+
+def align(size):
+    return (size + 3) & ~3
+
+
+def encode_name(path, name):
+    encoded = name.encode("ascii")
+
+    # names are always terminated, so the firmware can use them as strings
+    if len(encoded) >= NAME_LENGTH:
+        sys.exit("%s: the name is longer than %d characters" % (path, NAME_LENGTH - 1))
+
+    return encoded.ljust(NAME_LENGTH, b"\0")
+
+
+def load(path):
+    if path.lower().endswith(".png"):
+        name, w, h, kind, _, rows = assets.convert(path)
+        return name, w, h, FORMATS[kind], bytes(value for row in rows for value in row)
+
+    with open(path, "rb") as file:
+        return os.path.splitext(os.path.basename(path))[0], 0, 0, FORMATS["DATA"], file.read()
+
+
+def pack(game, paths):
+    loaded = sorted(((path,) + load(path) for path in paths), key=lambda asset: asset[1])
+    index  = b""
+    blobs  = b""
+    offset = HEADER_SIZE + (len(loaded) * ENTRY_SIZE)
+
+    if len(set(asset[1] for asset in loaded)) != len(loaded):
+        sys.exit("%s: two assets have the same name" % game)
+
+    for path, name, w, h, kind, data in loaded:
+        index += encode_name(path, name) + struct.pack("<IIHHB3x", offset + len(blobs), len(data), w, h, kind)
+        blobs += data.ljust(align(len(data)), b"\0")
+
+    body     = index + blobs
+    checksum = sum(struct.unpack("<%dI" % (len(body) // 4), body)) & 0xFFFFFFFF
+    header   = MAGIC + struct.pack("<HHII", VERSION, len(loaded), HEADER_SIZE + len(body), checksum) + encode_name(game, game)
+
+    return header + body
+
+
+def write_uf2(path, image, address):
+    blocks = [image[start:start + UF2_BLOCK_DATA] for start in range(0, len(image), UF2_BLOCK_DATA)]
+
+    with open(path, "wb") as file:
+        for number, block in enumerate(blocks):
+            file.write(struct.pack("<IIIIIIII", 0x0A324655, 0x9E5D5157, 0x00002000, address + (number * UF2_BLOCK_DATA), UF2_BLOCK_DATA, number,
+                                   len(blocks), UF2_FAMILY))
+            file.write(block.ljust(476, b"\0"))
+            file.write(struct.pack("<I", 0x0AB16F30))
+
+
+def write_c(path, image, symbol):
+    lines = []
+
+    for start in range(0, len(image), assets.BYTES_PER_LINE):
+        lines.append("    " + ", ".join("0x%02x" % value for value in image[start:start + assets.BYTES_PER_LINE]) + ",")
+
+    with open(path, "w") as file:
+        file.write("// generated by tools/cart.py, do not edit\n\n")
+        file.write('#include "pico/stdlib.h"\n\n')
+        file.write("const uint8_t __in_flash() __attribute__((aligned(4))) %s[] = {\n%s\n};\n" % (symbol, "\n".join(lines)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Packs a game and its assets into a cartridge image.")
+    parser.add_argument("game")
+    parser.add_argument("files", nargs="*")
+    parser.add_argument("--output")
+    parser.add_argument("--uf2")
+    parser.add_argument("--offset", type=lambda value: int(value, 0), default=0x100000)
+    parser.add_argument("--c")
+    parser.add_argument("--symbol", default="builtin_cart")
+    arguments = parser.parse_args()
+
+    image = pack(arguments.game, arguments.files)
+
+    if arguments.output:
+        with open(arguments.output, "wb") as file:
+            file.write(image)
+
+    if arguments.uf2:
+        write_uf2(arguments.uf2, image, XIP_BASE + arguments.offset)
+
+    if arguments.c:
+        write_c(arguments.c, image, arguments.symbol)
+
+
+if __name__ == "__main__":
+    main()